@@ -163,3 +163,10 @@ class AATree:
     
     def __len__(self):
         return self._root.size
+
+# The native backend from persist.cc, when it has been built. Its nodes are
+# not AA-tree nodes, so it has no show().
+try:
+    from persist import AATree
+except ImportError:
+    pass
@@ -0,0 +1,462 @@
+/*
+ * Comparative benchmark for the persistent maps in this repo against the
+ * standard containers and naive copy-on-write wrappers around them.
+ *
+ *   g++ -std=c++17 -O2 -pthread bench.cc -o bench
+ *   ./bench --keys=100000 --ops=1000000 --dist=uniform,zipf --read=0.5,0.95 \
+ *           --keylen=8,64 --retain=0,16 --struct=trie,hamt,map --json=out.jsonl
+ *
+ * Every combination of the comma separated axes is run in its own forked
+ * process, so peak RSS is per configuration rather than cumulative. Each
+ * configuration preloads `keys` keys, then performs `ops` operations drawn
+ * from the distribution: a read is a lookup of a present key, a write
+ * overwrites the value of a present key. With --retain=R the last R versions
+ * produced by writes are kept alive, which is what a persistent structure
+ * pays for and a mutable one cannot do at all (those runs are skipped).
+ *
+ * One JSON object per configuration goes to stdout (or the --json file); a
+ * human readable table goes to stderr. Latencies include the cost of two
+ * steady_clock reads per operation.
+ *
+ * Built with -DPERSIST_COUNTERS=1 the JSON also carries the hot-path
+ * counters of the persistent structures per operation.
+ */
+#include "chamt.h"
+#include "thread_safe_trie.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Allocation accounting. The benchmark is single threaded inside each child,
+ * so plain counters are enough; array and nothrow forms of operator new are
+ * routed here by the runtime.
+ */
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+void * operator new(size_t n) {
+    ++alloc_count;
+    alloc_bytes += n;
+    if (void * p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept {
+    std::free(p);
+}
+
+/*
+ * Adapters give every structure the same four operations. Snapshot is the
+ * handle kept alive for version retention; mutable containers have none.
+ */
+struct TrieBench {
+    using T = trie<uint64_t>;
+    static constexpr const char * name = "trie";
+    static constexpr bool persistent = true;
+    using Snapshot = T::NodePtr;
+    T::NodePtr root;
+
+    bool read(const std::string & key) const { return T::find_ptr(root, key) != nullptr; }
+    void write(const std::string & key, uint64_t value) { root = T::insert(root, key, value); }
+    Snapshot snapshot() const { return root; }
+};
+
+struct HAMTBench {
+    using T = HAMTMap<std::string, uint64_t>;
+    static constexpr const char * name = "hamt";
+    static constexpr bool persistent = true;
+    using Snapshot = T::Pointer;
+    T::Pointer root = T::create();
+
+    bool read(const std::string & key) const { return T::find_ptr(root, key) != nullptr; }
+    void write(const std::string & key, uint64_t value) { root = T::insert(root, key, value); }
+    Snapshot snapshot() const { return root; }
+};
+
+struct HAMTSetBench {
+    using T = HAMTSet<std::string>;
+    static constexpr const char * name = "hamtset";
+    static constexpr bool persistent = true;
+    using Snapshot = T::Pointer;
+    T::Pointer root = T::create();
+
+    bool read(const std::string & key) const { return T::find_ptr(root, key) != nullptr; }
+    void write(const std::string & key, uint64_t) { root = T::insert(root, key); }
+    Snapshot snapshot() const { return root; }
+};
+
+template <typename Map, const char * Name>
+struct StdBench {
+    static constexpr const char * name = Name;
+    static constexpr bool persistent = false;
+    using Snapshot = std::nullptr_t;
+    Map map;
+
+    bool read(const std::string & key) const { return map.find(key) != map.end(); }
+    void write(const std::string & key, uint64_t value) { map[key] = value; }
+    Snapshot snapshot() const { return nullptr; }
+};
+
+/* Whole-container copy on every write: the baseline persistence gets measured against. */
+template <typename Map, const char * Name>
+struct CowBench {
+    static constexpr const char * name = Name;
+    static constexpr bool persistent = true;
+    using Snapshot = std::shared_ptr<const Map>;
+    Snapshot root = std::make_shared<const Map>();
+
+    bool read(const std::string & key) const { return root->find(key) != root->end(); }
+    void write(const std::string & key, uint64_t value) {
+        auto next = std::make_shared<Map>(*root);
+        (*next)[key] = value;
+        root = std::move(next);
+    }
+    Snapshot snapshot() const { return root; }
+};
+
+static const char MAP_NAME[] = "map";
+static const char UMAP_NAME[] = "umap";
+static const char COWMAP_NAME[] = "cowmap";
+static const char COWUMAP_NAME[] = "cowumap";
+
+using MapBench = StdBench<std::map<std::string, uint64_t>, MAP_NAME>;
+using UMapBench = StdBench<std::unordered_map<std::string, uint64_t>, UMAP_NAME>;
+using CowMapBench = CowBench<std::map<std::string, uint64_t>, COWMAP_NAME>;
+using CowUMapBench = CowBench<std::unordered_map<std::string, uint64_t>, COWUMAP_NAME>;
+
+/*
+ * Scrambled zipfian generator after YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases"). Rank 0 is the hottest item; ranks are
+ * hashed so hot keys are not also adjacent keys.
+ */
+class Zipfian {
+public:
+    Zipfian(uint64_t n, double theta = 0.99) : n_(n), theta_(theta) {
+        double zeta2 = 0;
+        for (uint64_t i = 1; i <= 2; ++i) {
+            zeta2 += 1.0 / std::pow(double(i), theta);
+        }
+        for (uint64_t i = 1; i <= n; ++i) {
+            zetan_ += 1.0 / std::pow(double(i), theta);
+        }
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan_);
+    }
+
+    template <typename Rng>
+    uint64_t operator()(Rng & rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan_;
+        uint64_t rank;
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < 1.0 + std::pow(0.5, theta_)) {
+            rank = 1;
+        } else {
+            rank = uint64_t(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+        }
+        return fast_hash::mix(rank, fast_hash::SECRET[1]) % n_;
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_ = 0;
+    double alpha_;
+    double eta_;
+};
+
+/* Zero padded decimal, so longer keys share a longer common prefix. */
+static std::string make_key(uint64_t i, size_t len) {
+    std::string digits = std::to_string(i);
+    if (digits.size() >= len) {
+        return digits;
+    }
+    return std::string(len - digits.size(), '0') + digits;
+}
+
+struct Config {
+    std::string structure;
+    std::string dist;
+    double read_ratio;
+    size_t keylen;
+    size_t retain;
+    size_t keys;
+    size_t ops;
+    uint64_t seed;
+};
+
+struct Result {
+    double ops_per_sec;
+    uint64_t p50_ns, p99_ns, p999_ns;
+    double allocs_per_op;
+    double alloc_bytes_per_op;
+    long base_rss_kb;
+    long peak_rss_kb;
+    double events_per_op[counters::EVENTS];
+};
+
+static long max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template <typename Bench>
+Result run(const Config & c) {
+    Result r{};
+    r.base_rss_kb = max_rss_kb();
+
+    std::vector<std::string> keys;
+    keys.reserve(c.keys);
+    for (size_t i = 0; i < c.keys; ++i) {
+        keys.push_back(make_key(i, c.keylen));
+    }
+
+    /* The op stream is generated up front so the RNG is not timed. */
+    std::mt19937_64 rng(c.seed);
+    std::vector<uint32_t> stream(c.ops);
+    std::vector<bool> is_read(c.ops);
+    std::bernoulli_distribution coin(c.read_ratio);
+    if (c.dist == "zipf") {
+        Zipfian zipf(c.keys);
+        for (auto & k : stream) {
+            k = zipf(rng);
+        }
+    } else if (c.dist == "seq") {
+        for (size_t i = 0; i < c.ops; ++i) {
+            stream[i] = i % c.keys;
+        }
+    } else {
+        std::uniform_int_distribution<uint32_t> uniform(0, c.keys - 1);
+        for (auto & k : stream) {
+            k = uniform(rng);
+        }
+    }
+    for (size_t i = 0; i < c.ops; ++i) {
+        is_read[i] = coin(rng);
+    }
+
+    Bench bench;
+    for (size_t i = 0; i < c.keys; ++i) {
+        bench.write(keys[i], i);
+    }
+
+    std::vector<uint32_t> latency(c.ops);
+    std::deque<typename Bench::Snapshot> kept;
+    size_t found = 0;
+    counters::reset();
+    size_t allocs = alloc_count;
+    size_t bytes = alloc_bytes;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < c.ops; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        const auto & key = keys[stream[i]];
+        if (is_read[i]) {
+            found += bench.read(key);
+        } else {
+            bench.write(key, i);
+            if (c.retain) {
+                kept.push_back(bench.snapshot());
+                if (kept.size() > c.retain) {
+                    kept.pop_front();
+                }
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        latency[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.allocs_per_op = double(alloc_count - allocs) / c.ops;
+    r.alloc_bytes_per_op = double(alloc_bytes - bytes) / c.ops;
+    r.peak_rss_kb = max_rss_kb();
+    auto events = counters::thread_snapshot();
+    for (size_t e = 0; e < counters::EVENTS; ++e) {
+        r.events_per_op[e] = double(events.events[e]) / c.ops;
+    }
+    if (c.read_ratio == 1.0) {
+        assert(found == c.ops);
+    }
+
+    r.ops_per_sec = c.ops / sec;
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&](double q) { return latency[std::min(c.ops - 1, size_t(q * c.ops))]; };
+    r.p50_ns = pct(0.50);
+    r.p99_ns = pct(0.99);
+    r.p999_ns = pct(0.999);
+    return r;
+}
+
+template <typename Bench>
+bool dispatch(const Config & c, Result & r) {
+    if (c.structure != Bench::name) {
+        return false;
+    }
+    r = run<Bench>(c);
+    return true;
+}
+
+static bool run_any(const Config & c, Result & r) {
+    return dispatch<TrieBench>(c, r) || dispatch<HAMTBench>(c, r) || dispatch<HAMTSetBench>(c, r) ||
+           dispatch<MapBench>(c, r) || dispatch<UMapBench>(c, r) ||
+           dispatch<CowMapBench>(c, r) || dispatch<CowUMapBench>(c, r);
+}
+
+static bool is_persistent(const std::string & s) {
+    return s == TrieBench::name || s == HAMTBench::name || s == HAMTSetBench::name ||
+           s == CowMapBench::name || s == CowUMapBench::name;
+}
+
+static std::vector<std::string> split(const std::string & s) {
+    std::vector<std::string> out;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+static void usage() {
+    std::fprintf(stderr,
+        "usage: bench [--keys=N] [--ops=N] [--seed=N] [--dist=uniform,zipf,seq]\n"
+        "             [--read=R,...] [--keylen=L,...] [--retain=V,...]\n"
+        "             [--struct=trie,hamt,hamtset,map,umap,cowmap,cowumap] [--json=path]\n");
+}
+
+int main(int argc, char ** argv) {
+    size_t keys = 100000;
+    size_t ops = 1000000;
+    uint64_t seed = 42;
+    std::vector<std::string> dists{"uniform", "zipf", "seq"};
+    std::vector<std::string> reads{"0.5", "0.95", "1"};
+    std::vector<std::string> keylens{"8", "32"};
+    std::vector<std::string> retains{"0"};
+    /* cowmap and cowumap copy the whole map per write; opt in with --struct and a small --keys. */
+    std::vector<std::string> structs{"trie", "hamt", "hamtset", "map", "umap"};
+    std::string json;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            usage();
+            return 2;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "keys") {
+            keys = std::stoull(value);
+        } else if (name == "ops") {
+            ops = std::stoull(value);
+        } else if (name == "seed") {
+            seed = std::stoull(value);
+        } else if (name == "dist") {
+            dists = split(value);
+        } else if (name == "read") {
+            reads = split(value);
+        } else if (name == "keylen") {
+            keylens = split(value);
+        } else if (name == "retain") {
+            retains = split(value);
+        } else if (name == "struct") {
+            structs = split(value);
+        } else if (name == "json") {
+            json = value;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (keys == 0 || ops == 0) {
+        usage();
+        return 2;
+    }
+
+    FILE * out = stdout;
+    if (!json.empty() && !(out = std::fopen(json.c_str(), "w"))) {
+        std::perror(json.c_str());
+        return 1;
+    }
+
+    std::fprintf(stderr, "%-8s %-7s %5s %6s %6s %12s %8s %8s %8s %9s %10s\n",
+                 "struct", "dist", "read", "keylen", "retain",
+                 "ops/s", "p50 ns", "p99 ns", "p999 ns", "allocs/op", "peak KiB");
+    for (const auto & s : structs)
+    for (const auto & d : dists)
+    for (const auto & rd : reads)
+    for (const auto & kl : keylens)
+    for (const auto & rt : retains) {
+        Config c{s, d, std::stod(rd), std::stoul(kl), std::stoul(rt), keys, ops, seed};
+        if (c.retain && !is_persistent(s)) {
+            continue;
+        }
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            std::perror("pipe");
+            return 1;
+        }
+        std::fflush(out);
+        std::fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            Result r;
+            bool ok = run_any(c, r);
+            ssize_t n = ok ? write(fds[1], &r, sizeof(r)) : 0;
+            _exit(n == ssize_t(sizeof(r)) ? 0 : 1);
+        }
+        close(fds[1]);
+        Result r;
+        bool ok = read(fds[0], &r, sizeof(r)) == ssize_t(sizeof(r));
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::fprintf(stderr, "%s: unknown structure or run failed\n", s.c_str());
+            continue;
+        }
+
+        std::fprintf(out,
+            "{\"struct\":\"%s\",\"dist\":\"%s\",\"read_ratio\":%g,\"keylen\":%zu,\"retain\":%zu,"
+            "\"keys\":%zu,\"ops\":%zu,\"ops_per_sec\":%.0f,\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,"
+            "\"allocs_per_op\":%.3f,\"alloc_bytes_per_op\":%.1f,\"base_rss_kb\":%ld,\"peak_rss_kb\":%ld",
+            c.structure.c_str(), c.dist.c_str(), c.read_ratio, c.keylen, c.retain, c.keys, c.ops,
+            r.ops_per_sec, (unsigned long)r.p50_ns, (unsigned long)r.p99_ns, (unsigned long)r.p999_ns,
+            r.allocs_per_op, r.alloc_bytes_per_op, r.base_rss_kb, r.peak_rss_kb);
+        if (counters::ENABLED) {
+            std::fprintf(out,
+                ",\"path_copies_per_op\":%.3f,\"ptr_copies_per_op\":%.3f,\"rehashes_per_op\":%.3f,"
+                "\"node_allocs_per_op\":%.3f,\"levels_per_op\":%.3f",
+                r.events_per_op[counters::PATH_COPY], r.events_per_op[counters::PTR_COPY],
+                r.events_per_op[counters::REHASH], r.events_per_op[counters::ALLOC],
+                r.events_per_op[counters::LEVEL]);
+        }
+        std::fprintf(out, "}\n");
+        std::fprintf(stderr, "%-8s %-7s %5g %6zu %6zu %12.0f %8lu %8lu %8lu %9.2f %10ld\n",
+                     c.structure.c_str(), c.dist.c_str(), c.read_ratio, c.keylen, c.retain,
+                     r.ops_per_sec, (unsigned long)r.p50_ns, (unsigned long)r.p99_ns,
+                     (unsigned long)r.p999_ns, r.allocs_per_op, r.peak_rss_kb);
+    }
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
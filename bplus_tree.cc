@@ -0,0 +1,346 @@
+#include "bplus_tree.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+template <typename Tree, typename Map>
+static void assertEqual(const Tree & t, const Map & d) {
+    assert(t.size() == d.size());
+    auto keys = t.keys();
+    assert(keys.size() == d.size());
+    size_t i = 0;
+    for (const auto & [k, v] : d) {
+        assert(keys[i++] == k);
+        assert(t.get(k) == v);
+    }
+    i = 0;
+    auto it = d.begin();
+    for (auto b = t.begin(); b != t.end(); ++b, ++it, ++i) {
+        assert(b.key() == it->first && b.value() == it->second);
+    }
+    assert(i == d.size());
+}
+
+// the scenario of aa_tree_test.py
+void test_normal() {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> random(0, 1);
+    BPlusTree<double, double> t;
+    std::map<double, double> d;
+
+    for (int i = 0; i < 1000; ++i) {
+        double k = random(rng), v = random(rng);
+        d[k] = v;
+        t.set(k, v);
+    }
+    assertEqual(t, d);
+
+    for (auto & [k, v] : d) {
+        v = random(rng);
+        assert(!t.set(k, v));
+    }
+    assertEqual(t, d);
+
+    size_t n = d.size();
+    while (d.size() > n / 2) {
+        auto k = d.begin()->first;
+        d.erase(d.begin());
+        t.remove(k);
+    }
+    assertEqual(t, d);
+}
+
+void test_exception() {
+    BPlusTree<int, int> t;
+    t.set(0, 0);
+    assert(t.get(0) == 0);
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (const std::out_of_range &) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([&] { t.get(1); }));
+    assert(throws([&] { t.remove(1); }));
+    assert(throws([&] { t.select(1); }));
+    t.remove(0);
+    assert(t.size() == 0 && t.begin() == t.end());
+}
+
+// random set/erase against std::map with narrow nodes, so that every split,
+// shift and merge path runs many times
+template <size_t Fanout>
+void test_random() {
+    std::mt19937 rng(Fanout);
+    BPlusTree<int, int, std::less<int>, Fanout> t;
+    std::map<int, int> d;
+    for (int step = 0; step < 50000; ++step) {
+        int k = rng() % 3000;
+        if (rng() % 3) {
+            assert(t.set(k, step) == !d.count(k));
+            d[k] = step;
+        } else {
+            assert(t.erase(k) == (d.erase(k) == 1));
+        }
+        if (step % 1000 == 0) {
+            assertEqual(t, d);
+        }
+    }
+    assertEqual(t, d);
+    // drain completely, then grow again
+    while (!d.empty()) {
+        auto k = std::next(d.begin(), rng() % d.size())->first;
+        d.erase(k);
+        t.remove(k);
+    }
+    assert(t.size() == 0 && t.begin() == t.end());
+    for (int i = 0; i < 100; ++i) {
+        t.set(i, i);
+        d[i] = i;
+    }
+    assertEqual(t, d);
+}
+
+// A value that owns something, the way a PyRef does, and only copies; a
+// slot left holding one after its entry is gone shows up in `live`.
+struct Owned {
+    static inline long live = 0;
+    static inline std::map<int, long> copies;   // live copies of each id
+    bool held = false;
+    int id = 0;
+
+    Owned() = default;
+    explicit Owned(int id) : held(true), id(id) { ++live; ++copies[id]; }
+    Owned(const Owned & o) : held(o.held), id(o.id) { live += held; copies[id] += held; }
+    Owned & operator=(const Owned & o) {
+        live += long(o.held) - long(held);
+        copies[id] -= held;
+        copies[o.id] += o.held;
+        held = o.held;
+        id = o.id;
+        return *this;
+    }
+    ~Owned() { live -= held; copies[id] -= held; }
+
+    bool operator<(const Owned & o) const { return id < o.id; }
+};
+
+// every split, shift, merge and erase leaves exactly one Owned per entry
+template <size_t Fanout>
+void test_release() {
+    std::mt19937 rng(Fanout);
+    {
+        BPlusTree<int, Owned, std::less<int>, Fanout> t;
+        for (int step = 0; step < 20000; ++step) {
+            int k = rng() % 1000;
+            if (rng() % 2) {
+                t.set(k, Owned(k));
+            } else {
+                t.erase(k);
+            }
+            assert(Owned::live == long(t.size()));
+        }
+    }
+    assert(Owned::live == 0);
+
+    // keys are also copied into separators; none may outlive its entry
+    {
+        BPlusTree<Owned, int, std::less<Owned>, Fanout> t;
+        for (int step = 0; step < 20000; ++step) {
+            int k = rng() % 1000;
+            if (rng() % 2) {
+                t.set(Owned(k), k);
+                assert(Owned::copies[k] > 0);
+            } else {
+                t.erase(Owned(k));
+                assert(Owned::copies[k] == 0);
+            }
+        }
+        for (int k = 0; k < 1000; ++k) {
+            t.erase(Owned(k));
+            assert(Owned::copies[k] == 0);
+        }
+        assert(Owned::live == 0);
+    }
+}
+
+void test_order_statistics() {
+    std::mt19937 rng(5);
+    BPlusTree<int, int, std::less<int>, 8> t;
+    std::map<int, int> d;
+    for (int i = 0; i < 5000; ++i) {
+        int k = rng() % 20000;
+        t.set(k, i);
+        d[k] = i;
+    }
+    for (int i = 0; i < 2000; ++i) {
+        int k = rng() % 20000;
+        t.erase(k);
+        d.erase(k);
+    }
+    size_t r = 0;
+    for (const auto & [k, v] : d) {
+        assert(t.rank(k) == r);
+        assert(t.rank(k + 1) == r + 1);
+        auto s = t.select(r);
+        assert(s.key() == k && s.value() == v);
+        ++r;
+    }
+    for (int i = 0; i < 1000; ++i) {
+        int k = rng() % 21000 - 500;
+        auto lb = d.lower_bound(k);
+        assert(t.rank(k) == size_t(std::distance(d.begin(), lb)));
+    }
+}
+
+void test_range() {
+    BPlusTree<int, std::string, std::less<int>, 16> t;
+    for (int i = 0; i < 1000; i += 2) {
+        t.set(i, std::to_string(i));
+    }
+    assert(t.lower_bound(11).key() == 12);
+    assert(t.lower_bound(12).key() == 12);
+    assert(t.upper_bound(12).key() == 14);
+    assert(t.lower_bound(998).key() == 998);
+    assert(t.lower_bound(999) == t.end());
+    assert(t.upper_bound(-1).key() == 0);
+
+    std::vector<int> seen;
+    t.range(101, 301, [&](int k, const std::string & v) {
+        assert(v == std::to_string(k));
+        seen.push_back(k);
+    });
+    assert(seen.size() == 100 && seen.front() == 102 && seen.back() == 300);
+    seen.clear();
+    t.range(500, 500, [&](int k, const std::string &) {
+        seen.push_back(k);
+    });
+    assert(seen.empty());
+}
+
+void test_bulk_load() {
+    for (size_t n : {0, 1, 63, 64, 65, 4097, 100000}) {
+        std::vector<std::pair<int, int>> items;
+        std::map<int, int> d;
+        for (size_t i = 0; i < n; ++i) {
+            items.emplace_back(3 * i, i);
+            d[3 * i] = i;
+        }
+        BPlusTree<int, int> t;
+        t.bulk_load(items.begin(), items.end());
+        assertEqual(t, d);
+        for (size_t i = 0; i < n; i += 97) {
+            assert(t.select(i).key() == int(3 * i));
+            assert(t.rank(3 * i + 1) == i + 1);
+        }
+        // still a valid tree for updates
+        for (size_t i = 0; i < n; i += 5) {
+            t.set(3 * i + 1, -1);
+            d[3 * i + 1] = -1;
+            t.remove(3 * i);
+            d.erase(3 * i);
+        }
+        assertEqual(t, d);
+    }
+
+    std::vector<std::pair<int, int>> unsorted{{1, 1}, {1, 2}};
+    BPlusTree<int, int> t;
+    bool threw = false;
+    try {
+        t.bulk_load(unsorted.begin(), unsorted.end());
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw && t.size() == 0);
+}
+
+template <typename Callable>
+static double seconds(const Callable & f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bench_map() {
+    const size_t limit = 1 << 20;
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> keys(limit);
+    for (auto & k : keys) {
+        k = rng();
+    }
+
+    BPlusTree<uint64_t, uint64_t> t;
+    std::map<uint64_t, uint64_t> m;
+    double insertTree = seconds([&] {
+        for (auto k : keys) {
+            t.set(k, k);
+        }
+    });
+    double insertMap = seconds([&] {
+        for (auto k : keys) {
+            m[k] = k;
+        }
+    });
+    size_t sum = 0;
+    double findTree = seconds([&] {
+        for (auto k : keys) {
+            sum += *t.find(k);
+        }
+    });
+    double findMap = seconds([&] {
+        for (auto k : keys) {
+            sum += m.find(k)->second;
+        }
+    });
+    double scanTree = seconds([&] {
+        t.range(0, UINT64_MAX, [&](uint64_t, uint64_t v) {
+            sum += v;
+        });
+    });
+    double scanMap = seconds([&] {
+        for (const auto & kv : m) {
+            sum += kv.second;
+        }
+    });
+    double rankTree = seconds([&] {
+        for (size_t i = 0; i < limit; i += 16) {
+            sum += t.rank(keys[i]);
+        }
+    });
+
+    std::vector<std::pair<uint64_t, uint64_t>> sorted(m.begin(), m.end());
+    BPlusTree<uint64_t, uint64_t> loaded;
+    double bulk = seconds([&] {
+        loaded.bulk_load(sorted.begin(), sorted.end());
+    });
+
+    std::cout << "Mops/s   b+tree  std::map\n"
+              << "insert   " << limit / insertTree / 1e6 << "  " << limit / insertMap / 1e6 << "\n"
+              << "find     " << limit / findTree / 1e6 << "  " << limit / findMap / 1e6 << "\n"
+              << "scan     " << limit / scanTree / 1e6 << "  " << limit / scanMap / 1e6 << "\n"
+              << "rank     " << limit / 16 / rankTree / 1e6 << "\n"
+              << "bulk     " << limit / bulk / 1e6 << "  (checksum " << sum % 10 << ")\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        bench_map();
+        return 0;
+    }
+    test_normal();
+    test_exception();
+    test_random<4>();
+    test_random<5>();
+    test_random<64>();
+    test_release<4>();
+    test_release<5>();
+    test_order_statistics();
+    test_range();
+    test_bulk_load();
+}
@@ -0,0 +1,778 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+ * Mutable ordered map on a B+-tree, replacing aa_tree.py.
+ *
+ * Every node holds its keys in one contiguous array and searches it with a
+ * branchless binary search. All entries live in the leaves, and the leaves
+ * are chained, so a range scan walks arrays rather than pointers.
+ *
+ * An inner node also keeps the entry count of each child, the counterpart
+ * of Node.size in the prototype. rank and select therefore cost one
+ * descent.
+ *
+ * Nodes hold between Fanout / 2 and Fanout entries, except the root.
+ * Separators are copies of the smallest key of the subtree to their right.
+ * erase rewrites the one copied from a removed key, so inner nodes never
+ * keep a removed key alive.
+ *
+ * Keys and values are stored in fixed arrays, so both must be default
+ * constructible and move assignable.
+ */
+template <typename K, typename V, typename Compare = std::less<K>, size_t Fanout = 64>
+class BPlusTree {
+    static_assert(Fanout >= 4, "a node splits into two halves of at least two");
+
+    static constexpr size_t MIN = Fanout / 2;
+
+    struct Node {
+        bool leaf;
+        uint32_t n = 0;   // keys in a leaf, children in an inner node
+
+        explicit Node(bool l) : leaf(l) {}
+    };
+
+    struct Leaf : Node {
+        K keys[Fanout];
+        V values[Fanout];
+        Leaf *prev = nullptr;
+        Leaf *next = nullptr;
+
+        Leaf() : Node(true) {}
+    };
+
+    struct Inner : Node {
+        K keys[Fanout - 1];         // keys[i] separates kids[i] and kids[i + 1]
+        Node *kids[Fanout];
+        size_t counts[Fanout];      // entries under each kid
+
+        Inner() : Node(false) {}
+    };
+
+    Node *root_ = nullptr;
+    Leaf *head_ = nullptr;
+    Leaf *tail_ = nullptr;
+    size_t size_ = 0;
+
+    static Leaf * asLeaf(Node *n) {
+        return static_cast<Leaf *>(n);
+    }
+
+    static Inner * asInner(Node *n) {
+        return static_cast<Inner *>(n);
+    }
+
+    // first position in keys[0, n) not less than key
+    static size_t lowerBound(const K *keys, size_t n, const K & key) {
+        if (n == 0) {
+            return 0;
+        }
+        const K *base = keys;
+        while (n > 1) {
+            size_t half = n / 2;
+            base = Compare()(base[half], key) ? base + half : base;
+            n -= half;
+        }
+        return (base - keys) + Compare()(*base, key);
+    }
+
+    // first position in keys[0, n) greater than key
+    static size_t upperBound(const K *keys, size_t n, const K & key) {
+        if (n == 0) {
+            return 0;
+        }
+        const K *base = keys;
+        while (n > 1) {
+            size_t half = n / 2;
+            base = Compare()(key, base[half]) ? base : base + half;
+            n -= half;
+        }
+        return (base - keys) + !Compare()(key, *base);
+    }
+
+    static size_t childIndex(const Inner *p, const K & key) {
+        return upperBound(p->keys, p->n - 1, key);
+    }
+
+    static size_t total(Node *node) {
+        if (node->leaf) {
+            return node->n;
+        }
+        auto p = asInner(node);
+        size_t sum = 0;
+        for (size_t i = 0; i < p->n; ++i) {
+            sum += p->counts[i];
+        }
+        return sum;
+    }
+
+    static void destroy(Node *node) {
+        if (!node) {
+            return;
+        }
+        if (node->leaf) {
+            delete asLeaf(node);
+        } else {
+            auto p = asInner(node);
+            for (size_t i = 0; i < p->n; ++i) {
+                destroy(p->kids[i]);
+            }
+            delete p;
+        }
+    }
+
+    template <typename F>
+    static void forEachSeparator(Node *node, const F & f) {
+        if (!node || node->leaf) {
+            return;
+        }
+        auto p = asInner(node);
+        for (size_t i = 0; i < p->n; ++i) {
+            if (i > 0) {
+                f(p->keys[i - 1]);
+            }
+            forEachSeparator(p->kids[i], f);
+        }
+    }
+
+    // Slots past n are reset as they empty, so a removed entry is released
+    // at once rather than when the slot is next written or the node freed.
+    static void vacate(Leaf *leaf, size_t j) {
+        leaf->keys[j] = K();
+        leaf->values[j] = V();
+    }
+
+    using Path = std::vector<std::pair<Inner *, size_t>>;
+
+    Leaf * descend(const K & key, Path *path) const {
+        Node *node = root_;
+        while (!node->leaf) {
+            auto p = asInner(node);
+            size_t i = childIndex(p, key);
+            if (path) {
+                path->emplace_back(p, i);
+            }
+            node = p->kids[i];
+        }
+        return asLeaf(node);
+    }
+
+    // Inserts at pos into a full leaf, splitting it; returns the new right half.
+    Leaf * splitLeaf(Leaf *leaf, size_t pos, K && key, V && value) {
+        auto right = new Leaf();
+        size_t keep = (Fanout + 1) / 2;
+        // the combined sequence is leaf[0, pos) + new + leaf[pos, Fanout)
+        auto at = [&](size_t j) -> std::pair<K &, V &> {
+            if (j < pos) {
+                return {leaf->keys[j], leaf->values[j]};
+            }
+            if (j == pos) {
+                return {key, value};
+            }
+            return {leaf->keys[j - 1], leaf->values[j - 1]};
+        };
+        for (size_t j = keep; j <= Fanout; ++j) {
+            auto [k, v] = at(j);
+            right->keys[j - keep] = std::move(k);
+            right->values[j - keep] = std::move(v);
+        }
+        if (pos < keep) {
+            for (size_t j = keep - 1; j > pos; --j) {
+                leaf->keys[j] = std::move(leaf->keys[j - 1]);
+                leaf->values[j] = std::move(leaf->values[j - 1]);
+            }
+            leaf->keys[pos] = std::move(key);
+            leaf->values[pos] = std::move(value);
+        }
+        for (size_t j = keep; j < Fanout; ++j) {
+            vacate(leaf, j);
+        }
+        leaf->n = keep;
+        right->n = Fanout + 1 - keep;
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        } else {
+            tail_ = right;
+        }
+        leaf->next = right;
+        return right;
+    }
+
+    // Adds kid at position i + 1 with separator sep into p, which has room.
+    static void insertKid(Inner *p, size_t i, K && sep, Node *kid, size_t count) {
+        for (size_t j = p->n; j > i + 1; --j) {
+            p->kids[j] = p->kids[j - 1];
+            p->counts[j] = p->counts[j - 1];
+            p->keys[j - 1] = std::move(p->keys[j - 2]);
+        }
+        p->kids[i + 1] = kid;
+        p->counts[i + 1] = count;
+        p->keys[i] = std::move(sep);
+        ++p->n;
+    }
+
+    // Same, for a full p: splits it and returns the right half; sep becomes
+    // the key to push up.
+    static Inner * splitInner(Inner *p, size_t i, K & sep, Node *kid, size_t count) {
+        K keys[Fanout];
+        Node *kids[Fanout + 1];
+        size_t counts[Fanout + 1];
+        for (size_t j = 0, s = 0; j <= Fanout; ++j) {
+            if (j == i + 1) {
+                kids[j] = kid;
+                counts[j] = count;
+            } else {
+                kids[j] = p->kids[s];
+                counts[j] = p->counts[s];
+                ++s;
+            }
+        }
+        for (size_t j = 0, s = 0; j < Fanout; ++j) {
+            keys[j] = j == i ? std::move(sep) : std::move(p->keys[s++]);
+        }
+
+        auto right = new Inner();
+        size_t keep = (Fanout + 1) / 2;
+        for (size_t j = 0; j < keep; ++j) {
+            p->kids[j] = kids[j];
+            p->counts[j] = counts[j];
+        }
+        for (size_t j = 0; j + 1 < keep; ++j) {
+            p->keys[j] = std::move(keys[j]);
+        }
+        for (size_t j = keep - 1; j + 1 < Fanout; ++j) {
+            p->keys[j] = K();
+        }
+        for (size_t j = keep; j <= Fanout; ++j) {
+            right->kids[j - keep] = kids[j];
+            right->counts[j - keep] = counts[j];
+        }
+        for (size_t j = keep; j < Fanout; ++j) {
+            right->keys[j - keep] = std::move(keys[j]);
+        }
+        p->n = keep;
+        right->n = Fanout + 1 - keep;
+        sep = std::move(keys[keep - 1]);
+        return right;
+    }
+
+    // Restores the minimum fill of p->kids[i] from a neighbour.
+    void rebalance(Inner *p, size_t i) {
+        size_t l = i > 0 ? i - 1 : i;   // merge or shift between kids l and l + 1
+        Node *a = p->kids[l];
+        Node *b = p->kids[l + 1];
+        Node *other = l == i ? b : a;
+        if (other->n > MIN) {
+            if (a->leaf) {
+                shiftLeaves(p, l, asLeaf(a), asLeaf(b), l == i);
+            } else {
+                shiftInner(p, l, asInner(a), asInner(b), l == i);
+            }
+        } else {
+            if (a->leaf) {
+                mergeLeaves(asLeaf(a), asLeaf(b));
+            } else {
+                mergeInner(asInner(a), asInner(b), std::move(p->keys[l]));
+            }
+            p->counts[l] += p->counts[l + 1];
+            for (size_t j = l + 1; j + 1 < p->n; ++j) {
+                p->kids[j] = p->kids[j + 1];
+                p->counts[j] = p->counts[j + 1];
+                p->keys[j - 1] = std::move(p->keys[j]);
+            }
+            --p->n;
+            p->keys[p->n - 1] = K();
+        }
+    }
+
+    // Moves one entry between neighbouring leaves: from b to a when toLeft.
+    static void shiftLeaves(Inner *p, size_t l, Leaf *a, Leaf *b, bool toLeft) {
+        if (toLeft) {
+            a->keys[a->n] = std::move(b->keys[0]);
+            a->values[a->n] = std::move(b->values[0]);
+            ++a->n;
+            for (size_t j = 1; j < b->n; ++j) {
+                b->keys[j - 1] = std::move(b->keys[j]);
+                b->values[j - 1] = std::move(b->values[j]);
+            }
+            --b->n;
+            vacate(b, b->n);
+            ++p->counts[l];
+            --p->counts[l + 1];
+        } else {
+            for (size_t j = b->n; j > 0; --j) {
+                b->keys[j] = std::move(b->keys[j - 1]);
+                b->values[j] = std::move(b->values[j - 1]);
+            }
+            b->keys[0] = std::move(a->keys[a->n - 1]);
+            b->values[0] = std::move(a->values[a->n - 1]);
+            ++b->n;
+            --a->n;
+            vacate(a, a->n);
+            --p->counts[l];
+            ++p->counts[l + 1];
+        }
+        p->keys[l] = b->keys[0];
+    }
+
+    // Moves one child between neighbouring inner nodes through the parent.
+    static void shiftInner(Inner *p, size_t l, Inner *a, Inner *b, bool toLeft) {
+        if (toLeft) {
+            size_t c = b->counts[0];
+            a->kids[a->n] = b->kids[0];
+            a->counts[a->n] = c;
+            a->keys[a->n - 1] = std::move(p->keys[l]);
+            ++a->n;
+            p->keys[l] = std::move(b->keys[0]);
+            for (size_t j = 1; j < b->n; ++j) {
+                b->kids[j - 1] = b->kids[j];
+                b->counts[j - 1] = b->counts[j];
+                if (j + 1 < b->n) {
+                    b->keys[j - 1] = std::move(b->keys[j]);
+                }
+            }
+            --b->n;
+            b->keys[b->n - 1] = K();
+            p->counts[l] += c;
+            p->counts[l + 1] -= c;
+        } else {
+            size_t c = a->counts[a->n - 1];
+            for (size_t j = b->n; j > 0; --j) {
+                b->kids[j] = b->kids[j - 1];
+                b->counts[j] = b->counts[j - 1];
+                if (j > 1) {
+                    b->keys[j - 1] = std::move(b->keys[j - 2]);
+                }
+            }
+            b->kids[0] = a->kids[a->n - 1];
+            b->counts[0] = c;
+            b->keys[0] = std::move(p->keys[l]);
+            ++b->n;
+            p->keys[l] = std::move(a->keys[a->n - 2]);
+            --a->n;
+            a->keys[a->n - 1] = K();
+            p->counts[l] -= c;
+            p->counts[l + 1] += c;
+        }
+    }
+
+    void mergeLeaves(Leaf *a, Leaf *b) {
+        for (size_t j = 0; j < b->n; ++j) {
+            a->keys[a->n + j] = std::move(b->keys[j]);
+            a->values[a->n + j] = std::move(b->values[j]);
+        }
+        a->n += b->n;
+        a->next = b->next;
+        if (b->next) {
+            b->next->prev = a;
+        } else {
+            tail_ = a;
+        }
+        delete b;
+    }
+
+    static void mergeInner(Inner *a, Inner *b, K && sep) {
+        a->keys[a->n - 1] = std::move(sep);
+        for (size_t j = 0; j < b->n; ++j) {
+            a->kids[a->n + j] = b->kids[j];
+            a->counts[a->n + j] = b->counts[j];
+            if (j + 1 < b->n) {
+                a->keys[a->n + j] = std::move(b->keys[j]);
+            }
+        }
+        a->n += b->n;
+        delete b;
+    }
+
+public:
+    class Iterator {
+        friend class BPlusTree;
+        Leaf *leaf_ = nullptr;
+        size_t pos_ = 0;
+
+        Iterator(Leaf *leaf, size_t pos) : leaf_(leaf), pos_(pos) {
+            if (leaf_ && pos_ == leaf_->n) {
+                leaf_ = leaf_->next;
+                pos_ = 0;
+            }
+        }
+
+    public:
+        Iterator() = default;
+
+        const K & key() const {
+            return leaf_->keys[pos_];
+        }
+
+        V & value() const {
+            return leaf_->values[pos_];
+        }
+
+        Iterator & operator++() {
+            if (++pos_ == leaf_->n) {
+                leaf_ = leaf_->next;
+                pos_ = 0;
+            }
+            return *this;
+        }
+
+        bool operator==(const Iterator & o) const {
+            return leaf_ == o.leaf_ && pos_ == o.pos_;
+        }
+
+        bool operator!=(const Iterator & o) const {
+            return !(*this == o);
+        }
+    };
+
+    BPlusTree() = default;
+
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree & operator=(const BPlusTree &) = delete;
+
+    BPlusTree(BPlusTree && o) noexcept {
+        swap(o);
+    }
+
+    BPlusTree & operator=(BPlusTree && o) noexcept {
+        if (this != &o) {
+            clear();
+            swap(o);
+        }
+        return *this;
+    }
+
+    ~BPlusTree() {
+        destroy(root_);
+    }
+
+    void swap(BPlusTree & o) noexcept {
+        std::swap(root_, o.root_);
+        std::swap(head_, o.head_);
+        std::swap(tail_, o.tail_);
+        std::swap(size_, o.size_);
+    }
+
+    void clear() {
+        destroy(root_);
+        root_ = nullptr;
+        head_ = tail_ = nullptr;
+        size_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    const V * find(const K & key) const {
+        if (!root_) {
+            return nullptr;
+        }
+        Leaf *leaf = descend(key, nullptr);
+        size_t pos = lowerBound(leaf->keys, leaf->n, key);
+        if (pos < leaf->n && !Compare()(key, leaf->keys[pos])) {
+            return &leaf->values[pos];
+        }
+        return nullptr;
+    }
+
+    bool contains(const K & key) const {
+        return find(key) != nullptr;
+    }
+
+    const V & get(const K & key) const {
+        if (auto v = find(key)) {
+            return *v;
+        }
+        throw std::out_of_range("key not found");
+    }
+
+    // Inserts or overwrites; true when the key is new.
+    bool set(K key, V value) {
+        if (!root_) {
+            auto leaf = new Leaf();
+            leaf->keys[0] = std::move(key);
+            leaf->values[0] = std::move(value);
+            leaf->n = 1;
+            root_ = head_ = tail_ = leaf;
+            size_ = 1;
+            return true;
+        }
+
+        Path path;
+        Leaf *leaf = descend(key, &path);
+        size_t pos = lowerBound(leaf->keys, leaf->n, key);
+        if (pos < leaf->n && !Compare()(key, leaf->keys[pos])) {
+            leaf->values[pos] = std::move(value);
+            return false;
+        }
+        ++size_;
+
+        if (leaf->n < Fanout) {
+            for (size_t j = leaf->n; j > pos; --j) {
+                leaf->keys[j] = std::move(leaf->keys[j - 1]);
+                leaf->values[j] = std::move(leaf->values[j - 1]);
+            }
+            leaf->keys[pos] = std::move(key);
+            leaf->values[pos] = std::move(value);
+            ++leaf->n;
+            for (auto & [p, i] : path) {
+                ++p->counts[i];
+            }
+            return true;
+        }
+
+        Node *left = leaf;
+        Node *right = splitLeaf(leaf, pos, std::move(key), std::move(value));
+        K sep = asLeaf(right)->keys[0];
+        while (!path.empty()) {
+            auto [p, i] = path.back();
+            path.pop_back();
+            if (!right) {
+                ++p->counts[i];
+                continue;
+            }
+            p->counts[i] = total(left);
+            if (p->n < Fanout) {
+                insertKid(p, i, std::move(sep), right, total(right));
+                right = nullptr;
+            } else {
+                left = p;
+                right = splitInner(p, i, sep, right, total(right));
+            }
+        }
+        if (right) {
+            auto root = new Inner();
+            root->kids[0] = left;
+            root->kids[1] = right;
+            root->counts[0] = total(left);
+            root->counts[1] = total(right);
+            root->keys[0] = std::move(sep);
+            root->n = 2;
+            root_ = root;
+        }
+        return true;
+    }
+
+    // false when the key is absent
+    bool erase(const K & key) {
+        if (!root_) {
+            return false;
+        }
+        Path path;
+        Leaf *leaf = descend(key, &path);
+        size_t pos = lowerBound(leaf->keys, leaf->n, key);
+        if (pos == leaf->n || Compare()(key, leaf->keys[pos])) {
+            return false;
+        }
+        for (size_t j = pos + 1; j < leaf->n; ++j) {
+            leaf->keys[j - 1] = std::move(leaf->keys[j]);
+            leaf->values[j - 1] = std::move(leaf->values[j]);
+        }
+        --leaf->n;
+        vacate(leaf, leaf->n);
+        --size_;
+        if (pos == 0 && leaf->n > 0) {
+            // the separator copied from the removed key is where the path last went right
+            for (size_t d = path.size(); d > 0; --d) {
+                auto [p, i] = path[d - 1];
+                if (i > 0) {
+                    p->keys[i - 1] = leaf->keys[0];
+                    break;
+                }
+            }
+        }
+
+        Node *child = leaf;
+        while (!path.empty()) {
+            auto [p, i] = path.back();
+            path.pop_back();
+            --p->counts[i];
+            if (child->n < MIN) {
+                rebalance(p, i);
+            }
+            child = p;
+        }
+        if (!root_->leaf && root_->n == 1) {
+            Node *only = asInner(root_)->kids[0];
+            delete asInner(root_);
+            root_ = only;
+        } else if (root_->leaf && root_->n == 0) {
+            clear();
+        }
+        return true;
+    }
+
+    void remove(const K & key) {
+        if (!erase(key)) {
+            throw std::out_of_range("key not found");
+        }
+    }
+
+    Iterator begin() const {
+        return Iterator(head_, 0);
+    }
+
+    Iterator end() const {
+        return Iterator();
+    }
+
+    // the first entry not less than key
+    Iterator lower_bound(const K & key) const {
+        if (!root_) {
+            return end();
+        }
+        Leaf *leaf = descend(key, nullptr);
+        return Iterator(leaf, lowerBound(leaf->keys, leaf->n, key));
+    }
+
+    // the first entry greater than key
+    Iterator upper_bound(const K & key) const {
+        if (!root_) {
+            return end();
+        }
+        Leaf *leaf = descend(key, nullptr);
+        return Iterator(leaf, upperBound(leaf->keys, leaf->n, key));
+    }
+
+    // Calls callback(key, value) for every entry in [lo, hi).
+    template <typename Callable>
+    void range(const K & lo, const K & hi, const Callable & callback) const {
+        for (Leaf *leaf = lower_bound(lo).leaf_, *first = leaf; leaf; leaf = leaf->next) {
+            size_t from = leaf == first ? lowerBound(leaf->keys, leaf->n, lo) : 0;
+            for (size_t j = from; j < leaf->n; ++j) {
+                if (!Compare()(leaf->keys[j], hi)) {
+                    return;
+                }
+                callback(leaf->keys[j], leaf->values[j]);
+            }
+        }
+    }
+
+    // number of keys less than key
+    size_t rank(const K & key) const {
+        if (!root_) {
+            return 0;
+        }
+        size_t r = 0;
+        Node *node = root_;
+        while (!node->leaf) {
+            auto p = asInner(node);
+            size_t i = childIndex(p, key);
+            for (size_t j = 0; j < i; ++j) {
+                r += p->counts[j];
+            }
+            node = p->kids[i];
+        }
+        return r + lowerBound(asLeaf(node)->keys, node->n, key);
+    }
+
+    // the entry of rank i
+    Iterator select(size_t i) const {
+        if (i >= size_) {
+            throw std::out_of_range("index out of bound");
+        }
+        Node *node = root_;
+        while (!node->leaf) {
+            auto p = asInner(node);
+            size_t j = 0;
+            while (i >= p->counts[j]) {
+                i -= p->counts[j++];
+            }
+            node = p->kids[j];
+        }
+        return Iterator(asLeaf(node), i);
+    }
+
+    std::vector<K> keys() const {
+        std::vector<K> out;
+        out.reserve(size_);
+        for (Leaf *leaf = head_; leaf; leaf = leaf->next) {
+            out.insert(out.end(), leaf->keys, leaf->keys + leaf->n);
+        }
+        return out;
+    }
+
+    // Calls f(key) for each separator copy held by an inner node.
+    template <typename F>
+    void for_each_separator(const F & f) const {
+        forEachSeparator(root_, f);
+    }
+
+    // Replaces the contents with [first, last), pairs in strictly
+    // increasing key order, spread evenly over as few nodes as fit.
+    template <typename It>
+    void bulk_load(It first, It last) {
+        clear();
+        std::vector<Node *> level;
+        std::vector<K> mins;
+        std::vector<std::pair<K, V>> items;
+        for (; first != last; ++first) {
+            if (!items.empty() && !Compare()(items.back().first, first->first)) {
+                throw std::invalid_argument("bulk_load needs strictly increasing keys");
+            }
+            items.emplace_back(first->first, first->second);
+        }
+        if (items.empty()) {
+            return;
+        }
+
+        size_t leaves = (items.size() + Fanout - 1) / Fanout;
+        Leaf *prev = nullptr;
+        for (size_t l = 0, at = 0; l < leaves; ++l) {
+            size_t take = items.size() / leaves + (l < items.size() % leaves);
+            auto leaf = new Leaf();
+            for (size_t j = 0; j < take; ++j, ++at) {
+                leaf->keys[j] = std::move(items[at].first);
+                leaf->values[j] = std::move(items[at].second);
+            }
+            leaf->n = take;
+            leaf->prev = prev;
+            if (prev) {
+                prev->next = leaf;
+            } else {
+                head_ = leaf;
+            }
+            prev = leaf;
+            level.push_back(leaf);
+            mins.push_back(leaf->keys[0]);
+        }
+        tail_ = prev;
+        size_ = items.size();
+
+        while (level.size() > 1) {
+            size_t groups = (level.size() + Fanout - 1) / Fanout;
+            std::vector<Node *> up;
+            std::vector<K> upMins;
+            for (size_t g = 0, at = 0; g < groups; ++g) {
+                size_t take = level.size() / groups + (g < level.size() % groups);
+                auto p = new Inner();
+                for (size_t j = 0; j < take; ++j, ++at) {
+                    p->kids[j] = level[at];
+                    p->counts[j] = total(level[at]);
+                    if (j > 0) {
+                        p->keys[j - 1] = mins[at];
+                    }
+                }
+                p->n = take;
+                up.push_back(p);
+                upMins.push_back(mins[at - take]);
+            }
+            level = std::move(up);
+            mins = std::move(upMins);
+        }
+        root_ = level[0];
+    }
+};
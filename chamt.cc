@@ -1,479 +1,11 @@
-
-#include <memory>
-#include <variant>
-#include <optional>
-#include <vector>
-#include <cstring>
-#include <iostream>
-#include <sstream>
-#include <cassert>
-
-template <
-    typename Value,
-    typename KeyExtractor,
-    typename Hasher,
-    typename Comp = std::equal_to<
-        std::invoke_result_t<KeyExtractor, Value>
-    >
->
-class HAMT {
-public:
-    using Pointer = std::shared_ptr<const HAMT>;
-    using ValuePtr = std::shared_ptr<const Value>;
-private:
-    using K = std::invoke_result_t<KeyExtractor, Value>;
-    struct Node;
-    using NodePtr = std::shared_ptr<const Node>;
-    enum {
-        INDEX_LEAF = 0,
-        INDEX_NODE = 1
-    };
-    using VariantPtr = std::variant<ValuePtr, NodePtr>; // order is important
-
-    static const size_t PERIOD = sizeof(size_t) * 8 / 6;
-
-    static inline size_t gitBits(size_t hashcode,  size_t level) {
-        return (hashcode >> (6 * (level % PERIOD))) & 63;
-    }
-
-    static inline uint64_t lshift(size_t i) {
-        return ((uint64_t)1) << i;
-    }
-
-    struct Node : public std::enable_shared_from_this<Node> {
-        uint64_t bitmap;
-        std::vector< VariantPtr > elements;
-
-        Node(uint64_t b, std::vector< VariantPtr > && e)
-            : bitmap(b), elements(std::move(e)) {}
-        Node() : bitmap(0) {}
-
-        inline size_t InnerIndex(size_t i) const {
-            return __builtin_popcountll(bitmap & (lshift(i) - 1));
-        }
-
-        std::optional< VariantPtr > get(size_t i) const {
-            assert( i < 64 );
-            if (lshift(i) & bitmap) {
-                return elements[InnerIndex(i)];
-            } else {
-                return std::nullopt;
-            }
-        }
-
-        size_t size() const {
-            return elements.size();
-        }
-
-        NodePtr set(size_t i, VariantPtr kid) const {
-            assert( i < 64 );
-            if (lshift(i) & bitmap) {
-                if (kid != elements[InnerIndex(i)]) {
-                    std::vector< VariantPtr > e(elements);
-                    e[InnerIndex(i)] = kid;
-                    return std::make_shared<Node>(bitmap, std::move(e));
-                } else {
-                    return this->shared_from_this();
-                }
-            } else {
-                size_t cnt = InnerIndex(i);
-                std::vector< VariantPtr > e(elements.size() + 1);
-                std::copy(elements.begin(), elements.begin() + cnt, e.begin());
-                e[cnt] = kid;
-                std::copy(elements.begin() + cnt, elements.end(), e.begin() + cnt + 1);
-                return std::make_shared<Node>(bitmap | lshift(i), std::move(e));
-            }
-        }
-
-        NodePtr clear(size_t i) const {
-            assert( i < 64 );
-            if (lshift(i) & bitmap) {
-                size_t index = InnerIndex(i);
-                std::vector< VariantPtr > e(elements.size() - 1);
-                std::copy(elements.begin(), elements.begin() + index, e.begin());
-                std::copy(elements.begin() + index + 1, elements.end(), e.begin() + index);
-                return std::make_shared<const Node>(bitmap & ~(lshift(i)), std::move(e));
-            } else {
-                return this->shared_from_this();
-            }
-        }
-    };
-
-
-    NodePtr root_;
-    size_t size_;
-
-public:
-    HAMT() : root_(std::make_shared<Node>()), size_(0) {}
-    HAMT(const NodePtr & r, size_t s) : root_(r), size_(s) {}
-
-    static Pointer create() {
-        return std::make_shared<HAMT>();
-    }
-
-    static size_t size(const Pointer & hamt) {
-        return hamt->size_;
-    }
-
-    static ValuePtr find(const Pointer & hamt, const K & key) {
-        auto p = hamt->root_;
-        size_t hashcode = Hasher()(key, 0);
-        size_t level = 0;
-        while (1) {
-            size_t bits = gitBits(hashcode, level);
-            auto vp = p->get(bits);
-            if (vp) {
-                if (vp->index() == INDEX_LEAF) {
-                    if (Comp()(key, KeyExtractor()(*std::get<INDEX_LEAF>(*vp)))) {
-                        return std::get<INDEX_LEAF>(*vp);
-                    } else {
-                        return nullptr;
-                    }
-                } else {
-                    p = std::get<INDEX_NODE>(*vp);
-                }
-            } else {
-                return nullptr;
-            }
-            ++level;
-            if (level % PERIOD == 0) {
-                hashcode = Hasher()(key, level / PERIOD);
-            }
-        }
-    }
-
-    static Pointer remove(const Pointer & hamt, const K & key) {
-        struct Frame {
-            NodePtr node;
-            size_t bits;
-            Frame(NodePtr n, size_t b) : node(n), bits(b) {}
-        };
-        std::vector<Frame> stack;
-        bool removed = false;
-
-        {
-            auto p = hamt->root_;
-            size_t hashcode = Hasher()(key, 0);
-            size_t level = 0;
-            while (1) {
-                size_t bits = gitBits(hashcode, level);
-                stack.emplace_back(p, bits);
-                auto vp = p->get(bits);
-                if (vp) {
-                    if (vp->index() == INDEX_LEAF) {
-                        if (Comp()(key, KeyExtractor()(*std::get<INDEX_LEAF>(*vp)))) {
-                            removed = true;
-                            break;
-                        }
-                    } else {
-                        p = std::get<INDEX_NODE>(*vp);
-                    }
-                } else {
-                    break;
-                }
-                ++level;
-                if (level % PERIOD == 0) {
-                    hashcode = Hasher()(key, level / PERIOD);
-                }
-            }
-        }
-
-        if (removed) {
-            NodePtr p;
-            const auto & lastNode = stack.back().node;
-            const auto & lastBits = stack.back().bits;
-            VariantPtr t;
-            if (stack.size() > 1 && lastNode->elements.size() == 2 && (t = lastNode->elements[1 - lastNode->InnerIndex(lastBits)]).index() == INDEX_LEAF) {
-                stack.pop_back();
-                while (stack.size() > 1 && stack.back().node->elements.size() == 1) {
-                    stack.pop_back();
-                }
-                p = stack.back().node->set(stack.back().bits, t);
-                stack.pop_back();
-            } else {
-                p = lastNode->clear(lastBits);
-                stack.pop_back();
-            }
-            while (!stack.empty()) {
-                p = stack.back().node->set(stack.back().bits, p);
-                stack.pop_back();
-            }
-            return std::make_shared<HAMT>(p, hamt->size_ - 1);
-        } else {
-            return hamt;
-        }
-    }
-
-
-    static NodePtr merge(const ValuePtr & a, size_t hash_a, const ValuePtr & b, size_t hash_b, size_t level) {
-        size_t bits_a = gitBits(hash_a, level);
-        size_t bits_b = gitBits(hash_b, level);
-        if (bits_a == bits_b) {
-            if ((level + 1) % PERIOD == 0) {
-                hash_a = Hasher()(KeyExtractor()(*a), (level + 1) / PERIOD);
-                hash_b = Hasher()(KeyExtractor()(*b), (level + 1) / PERIOD);
-            }
-            auto p = merge(a, hash_a, b, hash_b, level + 1);
-            std::vector< VariantPtr > elements = {p,};
-            return std::make_shared<Node>(lshift(bits_a), std::move(elements));
-        } else {
-            uint64_t bitmap = lshift(bits_a) | lshift(bits_b);
-            if (bits_a < bits_b) {
-                return std::make_shared<Node>(bitmap, std::vector<VariantPtr>{a, b});
-            } else {
-                return std::make_shared<Node>(bitmap, std::vector<VariantPtr>{b, a});
-            }
-        }
-    }
-
-    static NodePtr insert(const NodePtr & root, const ValuePtr & leaf, size_t hashcode, size_t level, bool & replaced) {
-        size_t bits = gitBits(hashcode, level);
-        auto vp = root->get(bits);
-
-        if (!vp) {
-            return root->set(bits, leaf);
-        } else {
-            if (vp->index() == INDEX_NODE) {
-                if ((level + 1) % PERIOD == 0) {
-                    hashcode = Hasher()(KeyExtractor()(*leaf), (level + 1) / PERIOD);
-                }
-                auto p = insert(std::get<INDEX_NODE>(*vp), leaf, hashcode, level + 1, replaced);
-                return root->set(bits, p);
-            } else {
-                auto old_leaf = std::get<INDEX_LEAF>(*vp);
-                if (Comp()(KeyExtractor()(*leaf), KeyExtractor()(*old_leaf))) {
-                    replaced = true;
-                    return root->set(bits, leaf);
-                } else {
-                    size_t old_leaf_hash = Hasher()(KeyExtractor()(*old_leaf), (level + 1) / PERIOD);
-                    if ((level + 1) % PERIOD == 0) {
-                        hashcode = Hasher()(KeyExtractor()(*leaf), (level + 1) / PERIOD);
-                    }
-                    auto p = merge(old_leaf, old_leaf_hash, leaf, hashcode, level + 1);
-                    return root->set(bits, p);
-                }
-            }
-        }
-    }
-
-    static Pointer insert(const Pointer & hamt, Value && value) {
-        auto leaf = std::make_shared<Value>(std::move(value));
-        bool replaced = false;
-        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
-        size_t size = hamt->size_;
-        if (!replaced) {
-            ++size;
-        }
-        return std::make_shared<HAMT>(root, size);
-    }
-
-    static Pointer insert(const Pointer & hamt, const Value & value) {
-        auto leaf = std::make_shared<Value>(value);
-        bool replaced = false;
-        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(value), 0), 0, replaced);
-        size_t size = hamt->size_;
-        if (!replaced) {
-            ++size;
-        }
-        return std::make_shared<HAMT>(root, size);
-    }
-
-    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & hamt, const Value & value) {
-        auto leaf = std::make_shared<Value>(value);
-        bool replaced = false;
-        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
-        size_t size = hamt->size_;
-        if (!replaced) {
-            ++size;
-        }
-        return std::make_pair(std::make_shared<HAMT>(root, size), leaf);
-    }
-
-    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & hamt, Value && value) {
-        auto leaf = std::make_shared<Value>(std::move(value));
-        bool replaced = false;
-        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
-        size_t size = hamt->size_;
-        if (!replaced) {
-            ++size;
-        }
-        return std::make_pair(std::make_shared<HAMT>(root, size), leaf);
-    }
-
-    template <typename Callable>
-    static void for_each(const NodePtr & root, const Callable & callback) {
-        uint64_t bitmap = root->bitmap;
-        while (bitmap) {
-            int k = __builtin_ctzll(bitmap);
-            const auto & p = root->get(k);
-            assert (p);
-            if (p->index() == INDEX_LEAF) {
-                callback(*std::get<INDEX_LEAF>(*p));
-            } else {
-                for_each(std::get<INDEX_NODE>(*p), callback);
-            }
-            bitmap = bitmap & (bitmap - 1);
-        }
-    }
-
-    template <typename Callable>
-    static void for_each(const Pointer & hamt, const Callable & callback) {
-        for_each(hamt->root_, callback);
-    }
-
-    static void toDot(const Pointer & hamt, std::ostream & os) {
-        os << "digraph {\n"
-          "graph [pad=\"0.5\", nodesep=\"0.5\", ranksep=\"2\"];\n"
-          "node [shape=plain]\n"
-          "rankdir=LR;\n\n";
-
-        _toDot(hamt->root_, os);
-        os << "}\n";
-    }
-
-    static inline std::string addrToName(const void *p) {
-        std::stringstream ss;
-        ss << "node_" << p;
-        return ss.str();
-    }
-
-    static std::string _toDot(VariantPtr root, std::ostream & os) {
-        if (root.index() == INDEX_LEAF) {
-            std::stringstream ss;
-            const auto & leaf = *(std::get<INDEX_LEAF>(root));
-            ss << "leaf_" << KeyExtractor()(leaf);
-            return ss.str();
-        } else {
-            auto p = std::get<INDEX_NODE>(root);
-            std::string parent_name = addrToName(p.get());
-            os << parent_name << " [label=<\n"
-                    "  <table border=\"0\" cellborder=\"1\" cellspacing=\"0\">\n"
-                    "    <tr><td><b><i>" << parent_name << "</i></b></td></tr>\n";
-            
-            for (size_t i = 0; i < 64; ++i) {
-                auto e = p->get(i);
-                if (e) {
-                    os << "    <tr><td port=\"" << i << "\">" << i << "</td></tr>\n";
-                }
-            }
-            os << "  </table>>];\n";
-
-            for (size_t i = 0; i < 64; ++i) {
-                auto e = p->get(i);
-                if (e) {
-                    const auto & kid_name = _toDot(*e, os); 
-                    os << "    " << parent_name << ":" << i << " -> " << kid_name << "\n";
-                }
-            }
-            return parent_name;
-        }
-    }
-};
-
-template <typename K, typename V, typename Hasher, typename Comp = std::equal_to<K>>
-struct HAMTMap {
-    using Pair = std::pair<K, V>;
-    struct GetFirst {
-        const K & operator()(const Pair & p) {
-            return p.first;
-        }
-    };
-    using Impl = HAMT<Pair, GetFirst, Hasher, Comp>;
-    using Pointer = typename Impl::Pointer;
-    using ValuePtr = typename Impl::ValuePtr;
-
-    static ValuePtr find(const Pointer & p, const K & key) {
-        return Impl::find(p, key);
-    }
-
-    static size_t size(const Pointer & p) {
-        return Impl::size(p);
-    }
-
-    static Pointer insert(const Pointer & p, const K & key, V && value) {
-        return Impl::insert(p, std::make_pair(key, std::move(value)));
-    }
-
-    static Pointer insert(const Pointer & p, const K & key, const V & value) {
-        return Impl::insert(p, std::make_pair(key, value));
-    }
-
-    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & p, const K & key, const V & value) {
-        return Impl::insert_return_value(p, std::make_pair(key, value));
-    }
-
-    static Pointer remove(const Pointer & p, const K & key) {
-        return Impl::remove(p, key);
-    }
-    /*
-    static void toDot(Pointer root, std::ostream & os) {
-        Impl::toDot(root, os);
-    }*/
-    static Pointer create() {
-        return Impl::create();
-    }
-    
-    template <typename Callable>
-    static void for_each(const Pointer & hamt, const Callable & callback) {
-        Impl::for_each(hamt, callback);
-    }
-    static void toDot(const Pointer & hamt, std::ostream & os) {
-        Impl::toDot(hamt, os);
-    }
-};
-
-
-template <typename V, typename Hasher, typename Comp = std::equal_to<V>>
-struct HAMTSet {
-    struct Identity {
-        const V & operator()(const V & v) {
-            return v;
-        }
-    };
-    using Impl = HAMT<V, Identity, Hasher, Comp>;
-    using Pointer = typename Impl::Pointer;
-    using ValuePtr = typename Impl::ValuePtr;
-
-    static ValuePtr find(const Pointer & p, const V & key) {
-        return Impl::find(p, key);
-    }
-
-    static Pointer insert(const Pointer & p, V && key) {
-        return Impl::insert(p, std::move(key));
-    }
-
-    static Pointer insert(const Pointer & p, const V & key) {
-        return Impl::insert(p, key);
-    }
-
-    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & root, const V & key) {
-        return Impl::insert_return_value(root, key);
-    }
-
-    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & root, V && key) {
-        return Impl::insert_return_value(root, std::move(key));
-    }
-
-    static Pointer remove(const Pointer & root, const V & key) {
-        return Impl::remove(root, key);
-    }
-    static Pointer create() {
-        return Impl::create();
-    }
-
-    static size_t size(const Pointer & p) {
-        return Impl::size(p);
-    }
-
-    template <typename Callable>
-    static void for_each(const Pointer & hamt, const Callable & callback) {
-        Impl::for_each(hamt, callback);
-    }
-};
+#include "chamt.h"
+#include "read_scaling.h"
 
 #include <string>
 
+#include <cstdio>
 #include <set>
+#include <thread>
 #include <map>
 #include <cassert>
 
@@ -673,9 +205,954 @@ void test_move() {
     assert(*(r->value) == 1);
 }
    
-int main() {
+void test_checkpoint() {
+    struct GoodStringHasher {
+        size_t operator()(const std::string & s, size_t n) {
+            size_t hash = 7 + n;
+            for (char ch : s) {
+                hash = hash * (31 + n) + ch;
+            }
+            return hash;
+        }
+    };
+
+    using StringMap = HAMTMap<std::string, int, GoodStringHasher>;
+
+    struct Codec {
+        void encode(const StringMap::Pair & p, std::string & out) {
+            out.append(reinterpret_cast<const char *>(&p.second), sizeof(p.second));
+            out.append(p.first);
+        }
+        StringMap::Pair decode(const char *data, size_t len) {
+            int v;
+            std::memcpy(&v, data, sizeof(v));
+            return StringMap::Pair(std::string(data + sizeof(v), len - sizeof(v)), v);
+        }
+    };
+
+    const std::vector<std::string> paths = {"chamt_test_0.seg", "chamt_test_1.seg", "chamt_test_2.seg"};
+    StringMap::CheckpointWriter<Codec> writer;
+
+    const int limit = 1024;
+    auto v0 = StringMap::create();
+    for (int i = 0; i < limit; ++i) {
+        v0 = StringMap::insert(v0, std::to_string(i), i);
+    }
+    size_t full = writer.write(v0, paths[0]);
+    assert(full > limit);
+
+    auto v1 = StringMap::insert(v0, "x", -1);
+    v1 = StringMap::remove(v1, "7");
+    size_t delta = writer.write(v1, paths[1]);
+    // only the copied paths and the new leaf
+    assert(delta < 16);
+
+    assert(writer.write(v1, paths[2]) == 0);
+
+    StringMap::CheckpointLoader<Codec> loader;
+    auto l0 = loader.load(paths[0]);
+    auto l1 = loader.load(paths[1]);
+    auto l2 = loader.load(paths[2]);
+    assert(StringMap::size(l0) == limit);
+    assert(StringMap::size(l1) == limit);
+    assert(StringMap::size(l2) == limit);
+    for (int i = 0; i < limit; ++i) {
+        auto r = StringMap::find(l0, std::to_string(i));
+        assert(r && r->second == i);
+        r = StringMap::find(l1, std::to_string(i));
+        assert(i == 7 ? !r : (r && r->second == i));
+    }
+    assert(!StringMap::find(l0, "x"));
+    assert(StringMap::find(l2, "x")->second == -1);
+
+    {
+        StringMap::CheckpointView<Codec> view0({paths[0]});
+        StringMap::CheckpointView<Codec> view1({paths[0], paths[1]});
+        assert(view0.size() == limit);
+        assert(view1.size() == limit);
+        for (int i = 0; i < limit; ++i) {
+            auto r = view0.find(std::to_string(i));
+            assert(r && r->second == i);
+            r = view1.find(std::to_string(i));
+            assert(i == 7 ? !r : (r && r->second == i));
+        }
+        assert(!view0.find("x"));
+        assert(view1.find("x")->second == -1);
+    }
+
+    bool thrown = false;
+    try {
+        StringMap::CheckpointLoader<Codec>().load(paths[1]);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // a leaf length or a node's kid list running past the records
+    std::ifstream in(paths[0], std::ios::binary);
+    const std::string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t table_offset, count, last;
+    std::memcpy(&count, &good[16], 8);
+    std::memcpy(&table_offset, &good[good.size() - 32], 8);
+    std::memcpy(&last, &good[table_offset + 8 * (count - 1)], 8);
+    const std::string corrupt = "chamt_test_corrupt.seg";
+    // the view only reads the records on its path, so it is tried on the root
+    auto rejects = [&](size_t at, uint64_t x, bool viaView) {
+        std::string bad = good;
+        std::memcpy(&bad[at], &x, 8);
+        std::ofstream(corrupt, std::ios::binary).write(bad.data(), bad.size());
+        bool loader = false, view = !viaView;
+        try {
+            StringMap::CheckpointLoader<Codec>().load(corrupt);
+        } catch (const std::runtime_error &) {
+            loader = true;
+        }
+        try {
+            if (viaView) {
+                StringMap::CheckpointView<Codec>({corrupt}).find("1");
+            }
+        } catch (const std::runtime_error &) {
+            view = true;
+        }
+        return loader && view;
+    };
+    assert(good[24] == 0);                          // the first record is a leaf
+    assert(rejects(25, uint64_t(1) << 40, false));
+    assert(rejects(25, ~uint64_t(0), false));
+    assert(rejects(last + 1, ~uint64_t(0), true));                          // the root claims 64 kids
+    assert(rejects(table_offset + 8 * (count - 1), good.size() - 40, true));  // root offset past the records
+    std::remove(corrupt.c_str());
+
+    for (const auto & path : paths) {
+        std::remove(path.c_str());
+    }
+}
+
+void test_transaction() {
+    struct GoodStringHasher {
+        size_t operator()(const std::string & s, size_t n) {
+            size_t hash = 7 + n;
+            for (char ch : s) {
+                hash = hash * (31 + n) + ch;
+            }
+            return hash;
+        }
+    };
+
+    using StringMap = HAMTMap<std::string, int, GoodStringHasher>;
+
+    const int limit = 1024;
+    auto p = StringMap::create();
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+    }
+    StringMap::Root root(p);
+
+    // disjoint writers both commit
+    StringMap::Transaction a(root);
+    StringMap::Transaction b(root);
+    for (int i = 0; i < limit; ++i) {
+        if (i % 4 == 0) {
+            a.insert(std::to_string(i), -i);
+        } else if (i % 4 == 1) {
+            a.remove(std::to_string(i));
+        } else if (i % 4 == 2) {
+            b.remove(std::to_string(i));
+        }
+    }
+    for (int i = limit; i < limit + 100; ++i) {
+        a.insert(std::to_string(i), i);
+        b.insert(std::to_string(i + 100), i + 100);
+    }
+    assert(a.commit(root));
+    assert(b.commit(root));
+
+    auto r = root.load();
+    assert(StringMap::size(r) == limit / 4 * 2 + 200);
+    for (int i = 0; i < limit + 200; ++i) {
+        auto v = StringMap::find(r, std::to_string(i));
+        if (i >= limit) {
+            assert(v && v->second == i);
+        } else if (i % 4 == 0) {
+            assert(v && v->second == -i);
+        } else if (i % 4 == 3) {
+            assert(v && v->second == i);
+        } else {
+            assert(!v);
+        }
+    }
+
+    // both sides removing the same key is not a conflict
+    StringMap::Transaction c(root);
+    StringMap::Transaction d(root);
+    c.remove("3");
+    d.remove("3");
+    d.insert("7", 70);
+    assert(c.commit(root));
+    assert(d.commit(root));
+    assert(!StringMap::find(root.load(), "3"));
+    assert(StringMap::find(root.load(), "7")->second == 70);
+
+    // both sides writing the same key is
+    StringMap::Transaction e(root);
+    StringMap::Transaction f(root);
+    e.insert("11", 1);
+    e.insert("15", 1);
+    f.insert("11", 2);
+    f.remove("19");
+    assert(f.commit(root));
+    std::vector<StringMap::Conflict> conflicts;
+    auto before = root.load();
+    assert(!e.commit(root, conflicts));
+    assert(root.load() == before);
+    assert(conflicts.size() == 1);
+    assert(conflicts[0].base->second == 11);
+    assert(conflicts[0].ours->second == 1);
+    assert(conflicts[0].theirs->second == 2);
+
+    // removing everything leaves an empty map, so merged nodes stay canonical
+    r = root.load();
+    size_t n = StringMap::size(r);
+    std::vector<std::string> keys;
+    StringMap::for_each(r, [&keys](const StringMap::Pair & item) {
+        keys.push_back(item.first);
+    });
+    assert(keys.size() == n);
+    for (const auto & k : keys) {
+        r = StringMap::remove(r, k);
+    }
+    assert(StringMap::size(r) == 0);
+}
+
+void test_merge_collision() {
+    // collides on every level of the first generation
+    struct WeakHasher {
+        size_t operator()(int k, size_t n) {
+            return n == 0 ? k % 3 : k;
+        }
+    };
+
+    using IntSet = HAMTSet<int, WeakHasher>;
+    auto base = IntSet::create();
+    base = IntSet::insert(base, 0);
+
+    auto ours = IntSet::insert(base, 3);
+    ours = IntSet::insert(ours, 4);
+    auto theirs = IntSet::remove(base, 0);
+    theirs = IntSet::insert(theirs, 6);
+    theirs = IntSet::insert(theirs, 9);
+
+    std::vector<IntSet::Conflict> conflicts;
+    auto m = IntSet::merge3(base, ours, theirs, conflicts);
+    assert(conflicts.empty());
+    assert(IntSet::size(m) == 4);
+    for (int k : {3, 4, 6, 9}) {
+        assert(IntSet::find(m, k));
+    }
+    assert(!IntSet::find(m, 0));
+    for (int k : {3, 4, 6, 9}) {
+        m = IntSet::remove(m, k);
+    }
+    assert(IntSet::size(m) == 0);
+}
+
+void test_stats() {
+    struct GoodStringHasher {
+        size_t operator()(const std::string & s, size_t n) {
+            size_t hash = 7 + n;
+            for (char ch : s) {
+                hash = hash * (31 + n) + ch;
+            }
+            return hash;
+        }
+    };
+
+    using StringMap = HAMTMap<std::string, int, GoodStringHasher>;
+
+    auto p = StringMap::create();
+    {
+        auto s = StringMap::stats(p);
+        assert(s.nodes == 1);
+        assert(s.leaves == 0);
+        assert(s.fanout[0] == 1);
+    }
+
+    const int limit = 1024;
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+    }
+    auto s = StringMap::stats(p);
+    assert(s.leaves == limit);
+    size_t leaves = 0;
+    for (auto n : s.depth) {
+        leaves += n;
+    }
+    assert(leaves == limit);
+    size_t nodes = 0, elements = 0;
+    for (size_t k = 0; k < s.fanout.size(); ++k) {
+        nodes += s.fanout[k];
+        elements += k * s.fanout[k];
+    }
+    assert(nodes == s.nodes);
+    assert(elements == s.nodes - 1 + s.leaves);
+    assert(s.bytes > limit * sizeof(StringMap::Pair));
+
+    auto withStrings = StringMap::stats(p, [](const StringMap::Pair & item) {
+        return item.first.capacity();
+    });
+    assert(withStrings.bytes > s.bytes);
+
+    // everything but the wrapper is shared with itself
+    size_t all = StringMap::shared_bytes(p, p);
+    assert(all < s.bytes && all > s.bytes - 64);
+
+    auto q = StringMap::insert(p, "x", -1);
+    size_t shared = StringMap::shared_bytes(p, q);
+    assert(shared < all && shared > all / 2);
+
+    // same contents, no structure in common
+    auto r = StringMap::create();
+    for (int i = 0; i < limit; ++i) {
+        r = StringMap::insert(r, std::to_string(i), i);
+    }
+    assert(StringMap::shared_bytes(p, r) == 0);
+}
+
+void test_transparent() {
+    struct TransparentStringHasher {
+        using is_transparent = void;
+        size_t operator()(std::string_view s, size_t n) {
+            size_t hash = 7 + n;
+            for (char ch : s) {
+                hash = hash * (31 + n) + ch;
+            }
+            return hash;
+        }
+    };
+
+    using StringMap = HAMTMap<std::string, int, TransparentStringHasher, std::equal_to<>>;
+    using StringSet = HAMTSet<std::string, TransparentStringHasher, std::equal_to<>>;
+
+    auto p = StringMap::create();
+    auto s = StringSet::create();
+    const int limit = 1024;
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+        s = StringSet::insert(s, std::to_string(i));
+    }
+
+    char buf[16];
+    for (int i = 0; i < limit; ++i) {
+        std::string_view key(buf, std::snprintf(buf, sizeof(buf), "%d", i));
+        auto r = StringMap::find(p, key);
+        assert(r && r->second == i);
+        assert(StringMap::contains(p, key));
+        assert(StringSet::contains(s, key));
+    }
+    assert(StringMap::find(p, "7")->second == 7);
+    assert(!StringMap::contains(p, "x"));
+
+    p = StringMap::remove(p, std::string_view("7"));
+    s = StringSet::remove(s, "7");
+    assert(!StringMap::contains(p, "7"));
+    assert(!StringSet::contains(s, std::string("7")));
+    assert(StringMap::size(p) == limit - 1);
+    assert(StringSet::size(s) == limit - 1);
+
+    StringMap::Transaction t(p);
+    t.remove("8");
+    assert(!t.find(std::string_view("8")));
+}
+
+void test_small() {
+    using SmallMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 8>;
+    using BigMap = HAMTMap<std::string, int>;
+
+    auto p = SmallMap::create();
+    assert(SmallMap::stats(p).nodes == 0);
+
+    auto q = BigMap::create();
+    for (int i = 0; i < 8; ++i) {
+        p = SmallMap::insert(p, std::to_string(i), i);
+        q = BigMap::insert(q, std::to_string(i), i);
+    }
+    assert(SmallMap::size(p) == 8);
+    assert(SmallMap::stats(p).nodes == 0);
+    assert(SmallMap::stats(p).bytes < BigMap::stats(q).bytes);
+
+    // values live inline; the returned pointer keeps the version alive
+    SmallMap::ValuePtr r = SmallMap::find(p, "3");
+    {
+        auto q = SmallMap::insert(p, "3", 30);
+        assert(SmallMap::size(q) == 8);
+        assert(SmallMap::find(q, "3")->second == 30);
+        r = SmallMap::find(q, "3");
+    }
+    assert(r->second == 30);
+    assert(SmallMap::find(p, "3")->second == 3);
+
+    // promoted past the threshold
+    auto big = SmallMap::insert(p, "8", 8);
+    assert(SmallMap::size(big) == 9);
+    assert(SmallMap::stats(big).nodes > 0);
+    for (int i = 0; i < 9; ++i) {
+        assert(SmallMap::find(big, std::to_string(i))->second == i);
+    }
+
+    // and demoted again at half of it
+    for (int i = 8; i > 4; --i) {
+        big = SmallMap::remove(big, std::to_string(i));
+        assert(SmallMap::stats(big).nodes > 0);
+    }
+    big = SmallMap::remove(big, "4");
+    assert(SmallMap::size(big) == 4);
+    assert(SmallMap::stats(big).nodes == 0);
+    std::set<std::pair<std::string, int>> items;
+    SmallMap::for_each(big, [&items](const SmallMap::Pair & item) {
+        items.insert(item);
+    });
+    assert((items == std::set<std::pair<std::string, int>>{{"0", 0}, {"1", 1}, {"2", 2}, {"3", 3}}));
+    assert(SmallMap::remove(big, "x") == big);
+    big = SmallMap::remove(big, "0");
+    assert(SmallMap::size(big) == 3 && !SmallMap::contains(big, "0"));
+
+    // transactions over compact versions
+    SmallMap::Root root(SmallMap::create());
+    SmallMap::Transaction a(root);
+    SmallMap::Transaction b(root);
+    a.insert("a", 1);
+    b.insert("b", 2);
+    assert(a.commit(root));
+    assert(b.commit(root));
+    SmallMap::Transaction c(root);
+    SmallMap::Transaction d(root);
+    for (int i = 0; i < 10; ++i) {
+        c.insert(std::to_string(i), i);
+    }
+    d.insert("a", 10);
+    d.remove("b");
+    assert(c.commit(root));
+    assert(d.commit(root));
+    auto m = root.load();
+    assert(SmallMap::size(m) == 11);
+    assert(SmallMap::find(m, "a")->second == 10);
+    assert(!SmallMap::contains(m, "b"));
+    SmallMap::Transaction e(root);
+    SmallMap::Transaction f(root);
+    e.insert("a", 1);
+    f.insert("a", 2);
+    assert(e.commit(root));
+    std::vector<SmallMap::Conflict> conflicts;
+    assert(!f.commit(root, conflicts));
+    assert(conflicts.size() == 1 && conflicts[0].ours->second == 2);
+}
+
+void test_cache() {
+    using Cache = HAMTCache<std::string, int>;
+    {
+        Cache c(Cache::Options{100});
+        for (int i = 0; i < 100; ++i) {
+            c.put(std::to_string(i), i);
+        }
+        // every entry starts referenced, so the hand clears all of them and
+        // comes back round to evict "0"; then the rest of the first half is
+        // touched again
+        c.put("x", -1);
+        assert(!c.get("0"));
+        for (int i = 1; i < 50; ++i) {
+            c.get(std::to_string(i));
+        }
+        Cache::Batch b;
+        for (int i = 100; i < 140; ++i) {
+            b.put(std::to_string(i), i);
+        }
+        c.apply(std::move(b));
+        assert(c.size() == 100);
+        for (int i = 1; i < 50; ++i) {
+            assert(*c.get(std::to_string(i)) == i);
+        }
+        auto n = c.counters();
+        assert(n.evictions == 41);
+        assert(n.hits == 49 + 49);
+        assert(n.misses == 1);
+        for (int i = 50; i < 90; ++i) {
+            assert(!c.get(std::to_string(i)));
+        }
+        assert(*c.get("99") == 99);
+        assert(c.counters().misses == 41);
+
+        auto v = c.get("1");
+        c.erase("1");
+        assert(!c.get("1"));
+        assert(*v == 1);
+        assert(c.size() == 99);
+    }
+    {
+        // byte budget
+        Cache c(Cache::Options{100, 1000});
+        for (int i = 0; i < 30; ++i) {
+            c.put(std::to_string(i), i, 100);
+        }
+        assert(c.size() == 10);
+        assert(c.bytes() == 1000);
+        c.put("big", 0, 550);
+        assert(c.bytes() <= 1000);
+        assert(c.get("big"));
+    }
+    {
+        // ttl
+        Cache c(Cache::Options{100, SIZE_MAX, std::chrono::milliseconds(20)});
+        c.put("a", 1);
+        assert(c.get("a"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        assert(!c.get("a"));
+        assert(c.size() == 1);
+        c.expire();
+        assert(c.size() == 0);
+        assert(c.counters().expirations == 1);
+    }
+    {
+        // read-through
+        Cache c(Cache::Options{10});
+        int loads = 0;
+        auto load = [&loads](const std::string & key) {
+            ++loads;
+            return static_cast<int>(key.size());
+        };
+        assert(*c.get("abc", load) == 3);
+        assert(*c.get("abc", load) == 3);
+        assert(loads == 1);
+    }
+    {
+        // readers never block on the writer
+        Cache c(Cache::Options{256});
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> reads{0};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&c, &done, &reads] {
+                uint64_t n = 0;
+                while (!done.load()) {
+                    for (int i = 0; i < 512; ++i, ++n) {
+                        auto v = c.get(std::to_string(i));
+                        assert(!v || *v == i);
+                    }
+                }
+                reads += n;
+            });
+        }
+        for (int round = 0; round < 20; ++round) {
+            Cache::Batch b;
+            for (int i = 0; i < 512; ++i) {
+                b.put(std::to_string((i * 7 + round) % 512), (i * 7 + round) % 512);
+            }
+            c.apply(std::move(b));
+        }
+        done = true;
+        for (auto & t : readers) {
+            t.join();
+        }
+        assert(c.size() == 256);
+        // per-thread counts add up, and a value outlives the version it came from
+        auto n = c.counters();
+        assert(n.hits + n.misses == reads);
+        auto v = c.get("1");
+        c.erase("1");
+        assert(!c.get("1") && *v == 1);
+    }
+    {
+        // one thread alternating between caches keeps one slot in each
+        Cache a(Cache::Options{8});
+        Cache b(Cache::Options{8});
+        a.put("k", 1);
+        b.put("k", 2);
+        for (int i = 0; i < 100; ++i) {
+            assert(*a.get("k") == 1 && *b.get("k") == 2);
+        }
+        assert(a.counters().hits == 100 && b.counters().hits == 100);
+    }
+}
+
+void test_find_ptr() {
+    using StringMap = HAMTMap<std::string, int>;
+    using SmallMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 4>;
+
+    auto p = StringMap::create();
+    auto s = SmallMap::create();
+    const int limit = 1024;
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+        if (i < 3) {
+            s = SmallMap::insert(s, std::to_string(i), i);
+        }
+    }
+    for (int i = 0; i < limit; ++i) {
+        const StringMap::Pair *v = StringMap::find_ptr(p, std::to_string(i));
+        assert(v && v->second == i);
+        assert(v == StringMap::find(p, std::to_string(i)).get());
+        assert(v == StringMap::find_copying(p, std::to_string(i)).get());
+    }
+    assert(!StringMap::find_ptr(p, "x"));
+    assert(!StringMap::find_copying(p, "x"));
+    assert(SmallMap::find_copying(s, "2")->second == 2);
+    assert(!StringMap::find_ptr(StringMap::create(), "x"));
+    assert(SmallMap::find_ptr(s, "2")->second == 2);
+    assert(!SmallMap::find_ptr(s, "3"));
+
+    // the borrowed pointer is tied to the version, not to the latest one
+    const StringMap::Pair *v = StringMap::find_ptr(p, "7");
+    auto q = StringMap::remove(p, "7");
+    assert(!StringMap::find_ptr(q, "7"));
+    assert(v->second == 7);
+}
+
+// Between two versions that share most of their leaves, every value is
+// visited by at most one of them, and by the survivor once the other goes.
+void test_for_each_owned() {
+    using StringMap = HAMTMap<std::string, int>;
+    auto p = StringMap::create();
+    const int limit = 1024;
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+    }
+    std::map<const StringMap::Pair *, int> seen;
+    auto visit = [&](const StringMap::Pair & v) {
+        ++seen[&v];
+    };
+    StringMap::for_each_owned(p, visit);
+    assert(seen.size() == limit);
+
+    auto handle = p;
+    seen.clear();
+    StringMap::for_each_owned(p, visit);
+    assert(seen.empty());
+    handle = nullptr;
+
+    auto q = StringMap::insert(p, "x", -1);
+    seen.clear();
+    StringMap::for_each_owned(p, visit);
+    StringMap::for_each_owned(q, visit);
+    assert(seen.size() < limit / 2);
+    for (const auto & [v, n] : seen) {
+        assert(n == 1);
+    }
+    q = nullptr;
+    seen.clear();
+    StringMap::for_each_owned(p, visit);
+    assert(seen.size() == limit);
+
+    using SmallMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 4>;
+    auto s = SmallMap::insert(SmallMap::create(), "a", 1);
+    size_t n = 0;
+    SmallMap::for_each_owned(s, [&](const SmallMap::Pair &) { ++n; });
+    assert(n == 1);
+}
+
+static size_t allocations = 0;
+static size_t arrays = 0;   // allocations of more than one object: the child vectors
+
+template <typename T>
+struct CountingAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = CountingAllocator<U>;
+    };
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &) {}
+
+    T * allocate(size_t n) {
+        ++allocations;
+        arrays += n > 1;
+        return std::allocator<T>::allocate(n);
+    }
+};
+
+void test_policy() {
+    using LocalMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 0,
+                             SingleThreadRefCount<CountingAllocator>>;
+    using LocalSmallMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 4,
+                                  SingleThreadRefCount<>>;
+
+    auto p = LocalMap::create();
+    auto s = LocalSmallMap::create();
+    const int limit = 1024;
+    for (int i = 0; i < limit; ++i) {
+        p = LocalMap::insert(p, std::to_string(i), i);
+        s = LocalSmallMap::insert(s, std::to_string(i), i);
+    }
+    assert(allocations > limit);
+    assert(arrays > 0);
+    for (int i = 0; i < limit; ++i) {
+        if (i % 2) {
+            p = LocalMap::remove(p, std::to_string(i));
+        }
+        if (i >= 2) {
+            s = LocalSmallMap::remove(s, std::to_string(i));
+        }
+    }
+    for (int i = 0; i < limit; ++i) {
+        assert(LocalMap::contains(p, std::to_string(i)) == (i % 2 == 0));
+        assert(i % 2 || LocalMap::find(p, std::to_string(i))->second == i);
+        assert(LocalSmallMap::contains(s, std::to_string(i)) == (i < 2));
+    }
+    assert(LocalSmallMap::stats(s).nodes == 0);
+
+    std::vector<LocalMap::Conflict> conflicts;
+    auto ours = LocalMap::insert(p, "x", 1);
+    auto theirs = LocalMap::remove(p, "0");
+    auto m = LocalMap::merge3(p, ours, theirs, conflicts);
+    assert(conflicts.empty());
+    assert(LocalMap::contains(m, "x") && !LocalMap::contains(m, "0"));
+    assert(LocalMap::shared_bytes(p, m) > 0);
+}
+
+// chi-square of `hashes` over the 64 buckets of every level in one generation
+static double worstChiSquare(const std::vector<size_t> & hashes) {
+    double worst = 0;
+    const size_t period = sizeof(size_t) * 8 / 6;
+    for (size_t level = 0; level < period; ++level) {
+        std::vector<size_t> buckets(64);
+        for (auto h : hashes) {
+            ++buckets[(h >> (6 * level)) & 63];
+        }
+        double expect = hashes.size() / 64.0;
+        double chi = 0;
+        for (auto n : buckets) {
+            chi += (n - expect) * (n - expect) / expect;
+        }
+        worst = std::max(worst, chi);
+    }
+    return worst;
+}
+
+void test_fast_hasher() {
+    FastHasher<> h;
+    const size_t limit = 1 << 16;
+
+    // string, string_view and char array with the same bytes agree
+    assert(h(std::string("abc"), 0) == h(std::string_view("abc"), 0));
+    assert(h("abc", 0) == h(std::string_view("abc"), 0));
+    assert(h("abc", 0) != h("abc", 1));
+    assert(FastHasher<1>()("abc", 0) != h("abc", 0));
+    assert(h(std::make_pair(1, 2), 0) != h(std::make_pair(2, 1), 0));
+    assert(h(std::make_tuple(1, std::string("a")), 0) == h(std::make_pair(1, std::string("a")), 0));
+
+    // df = 63; 140 is far beyond the 0.9999 quantile
+    std::vector<size_t> strings, ints, sequential, longStrings;
+    for (size_t i = 0; i < limit; ++i) {
+        strings.push_back(h(std::to_string(i), 0));
+        ints.push_back(h(i * 64, 0));
+        sequential.push_back(h(i, 1));
+        longStrings.push_back(h(std::string(100, 'x') + std::to_string(i), 0));
+    }
+    assert(worstChiSquare(strings) < 140);
+    assert(worstChiSquare(ints) < 140);
+    assert(worstChiSquare(sequential) < 140);
+    assert(worstChiSquare(longStrings) < 140);
+
+    // flipping one input bit flips about half of the output bits
+    double flips = 0;
+    size_t trials = 0;
+    for (uint64_t x = 1; x < 4096; x += 7) {
+        for (int bit = 0; bit < 64; ++bit) {
+            flips += __builtin_popcountll(h(x, 0) ^ h(x ^ (uint64_t(1) << bit), 0));
+            ++trials;
+        }
+    }
+    flips /= trials;
+    assert(flips > 31 && flips < 33);
+
+    // 2^16 keys: about two pairs are expected to share 30 bits, none 42
+    using StringMap = HAMTMap<std::string, size_t>;
+    auto p = StringMap::create();
+    for (size_t i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, std::to_string(i), i);
+    }
+    assert(StringMap::stats(p).depth.size() <= 7);
+    for (size_t i = 0; i < limit; ++i) {
+        assert(StringMap::find(p, std::to_string(i))->second == i);
+    }
+}
+
+// Build with -DPERSIST_COUNTERS=1 or =2 to exercise the counters; off,
+// every snapshot must read zero.
+void test_counters() {
+    using IntMap = HAMTMap<int, int>;
+    const int limit = 1000;
+    counters::reset();
+    auto p = IntMap::create();
+    for (int i = 0; i < limit; ++i) {
+        p = IntMap::insert(p, i, i);
+    }
+    auto q = IntMap::remove(p, 7);
+    assert(IntMap::size(q) == limit - 1);
+
+    auto s = counters::thread_snapshot();
+    if constexpr (!counters::ENABLED) {
+        assert(s.ops[counters::INSERT] == 0 && s.events[counters::PATH_COPY] == 0);
+        return;
+    }
+    assert(s.ops[counters::INSERT] == limit);
+    assert(s.ops[counters::REMOVE] == 1);
+    // every insert rebuilds at least the root and allocates a leaf and a version
+    assert(s.events[counters::PATH_COPY] > limit);
+    assert(s.events[counters::ALLOC] > 3 * limit);
+    assert(s.events[counters::LEVEL] > limit);
+    assert(s.events[counters::PTR_COPY] > s.events[counters::PATH_COPY]);
+
+    // other threads show up in the global snapshot, also after they exit
+    std::thread([&] {
+        IntMap::insert(p, -1, -1);
+    }).join();
+    assert(counters::snapshot().ops[counters::INSERT] == limit + 1);
+    assert(counters::thread_snapshot().ops[counters::INSERT] == limit);
+
+    if constexpr (counters::HISTOGRAMS) {
+        uint64_t ops = 0;
+        for (auto n : counters::snapshot().histogram[counters::INSERT][counters::LEVEL]) {
+            ops += n;
+        }
+        assert(ops == limit + 1);
+        // no insert of a small map descends 2^5 levels
+        for (size_t b = 6; b < counters::BUCKETS; ++b) {
+            assert(s.histogram[counters::INSERT][counters::LEVEL][b] == 0);
+        }
+    }
+
+    counters::reset();
+    assert(counters::snapshot().ops[counters::INSERT] == 0);
+}
+
+template <typename Hasher>
+static void bench_hash_bytes(const char *name, size_t len) {
+    const size_t total = 256 << 20;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 1024; ++i) {
+        std::string k(len, 'a');
+        for (size_t j = 0; j < len; ++j) {
+            k[j] = 'a' + (i * 131 + j * 7) % 26;
+        }
+        keys.push_back(k);
+    }
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < total; done += len * keys.size()) {
+        for (const auto & k : keys) {
+            sink += Hasher()(k, 0);
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << " len=" << len << ": " << total / sec / (1 << 20) << " MB/s, "
+              << total / len / sec / 1e6 << " Mhash/s (" << (sink & 1) << ")\n";
+}
+
+template <typename Hasher>
+static void bench_hamt(const char *name) {
+    using StringMap = HAMTMap<std::string, int, Hasher>;
+    const int limit = 1 << 18;
+    std::vector<std::string> keys;
+    for (int i = 0; i < limit; ++i) {
+        keys.push_back("user:" + std::to_string(i * 7919));
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto p = StringMap::create();
+    for (int i = 0; i < limit; ++i) {
+        p = StringMap::insert(p, keys[i], i);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (int i = 0; i < limit; ++i) {
+        found += StringMap::find(p, keys[i]) != nullptr;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << name << " HAMT: insert " << limit / std::chrono::duration<double>(mid - start).count() / 1e6
+              << " Mops/s, find " << limit / std::chrono::duration<double>(end - mid).count() / 1e6
+              << " Mops/s, depth " << StringMap::stats(p).depth.size() << " (" << found << ")\n";
+}
+
+void bench_hasher() {
+    struct GoodStringHasher {
+        size_t operator()(const std::string & s, size_t n) {
+            size_t hash = 7 + n;
+            for (char ch : s) {
+                hash = hash * (31 + n) + ch;
+            }
+            return hash;
+        }
+    };
+
+    for (size_t len : {8, 32, 256, 4096}) {
+        bench_hash_bytes<GoodStringHasher>("GoodStringHasher", len);
+        bench_hash_bytes<FastHasher<>>("FastHasher", len);
+    }
+    bench_hamt<GoodStringHasher>("GoodStringHasher");
+    bench_hamt<FastHasher<>>("FastHasher");
+}
+
+// find_copying copies the shared_ptr of every node on the path; find_ptr
+// touches no reference count.
+void bench_read_scaling() {
+    using StringMap = HAMTMap<std::string, int>;
+    std::vector<std::string> keys;
+    auto p = StringMap::create();
+    for (int i = 0; i < (1 << 16); ++i) {
+        keys.push_back("user:" + std::to_string(i * 7919));
+        p = StringMap::insert(p, keys.back(), i);
+    }
+    read_scaling(keys,
+                 [&](const std::string & key) { return StringMap::find_copying(p, key) != nullptr; },
+                 [&](const std::string & key) { return StringMap::find_ptr(p, key) != nullptr; });
+}
+
+template <typename Map>
+static double bench_insert() {
+    const int limit = 1 << 17;
+    std::vector<std::string> keys;
+    for (int i = 0; i < limit; ++i) {
+        keys.push_back("user:" + std::to_string(i * 7919));
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto p = Map::create();
+    for (int i = 0; i < limit; ++i) {
+        p = Map::insert(p, keys[i], i);
+    }
+    for (int i = 0; i < limit; i += 2) {
+        p = Map::remove(p, keys[i]);
+    }
+    return limit * 1.5 / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+void bench_policy() {
+    using AtomicMap = HAMTMap<std::string, int>;
+    using LocalMap = HAMTMap<std::string, int, FastHasher<>, std::equal_to<std::string>, 0, SingleThreadRefCount<>>;
+    std::cout << "insert+remove Mops/s: atomic " << bench_insert<AtomicMap>()
+              << ", single-thread " << bench_insert<LocalMap>() << "\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        bench_hasher();
+        bench_read_scaling();
+        bench_policy();
+        return 0;
+    }
+
     test_rehash();
     test_remove();
     test_set();
     test_move();
+    test_checkpoint();
+    test_transaction();
+    test_merge_collision();
+    test_stats();
+    test_transparent();
+    test_fast_hasher();
+    test_small();
+    test_cache();
+    test_find_ptr();
+    test_for_each_owned();
+    test_policy();
+    test_counters();
 }
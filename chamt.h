@@ -0,0 +1,2248 @@
+#pragma once
+
+#include <memory>
+#include <variant>
+#include <optional>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ownership.h"
+#include "counters.h"
+
+// Hashers and comparators opt in to heterogeneous lookup by declaring
+// `using is_transparent = void;`, as with the standard associative containers.
+template <typename T, typename = void>
+struct is_transparent : std::false_type {};
+
+template <typename T>
+struct is_transparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
+
+template <typename T, typename = void>
+struct has_equal : std::false_type {};
+
+template <typename T>
+struct has_equal<T, std::void_t<decltype(std::declval<const T &>() == std::declval<const T &>())>> : std::true_type {};
+
+/*
+ * Default hasher family for the Hasher(key, n) protocol.
+ *
+ * Byte strings use a wyhash-style hash. It reads 8 bytes at a time and
+ * runs three independent 64x64->128 multiply lanes for inputs longer than
+ * 48 bytes. Integers go through a single multiply-fold. Pairs and tuples
+ * chain their elements through the seed.
+ *
+ * One 64-bit hash covers PERIOD levels of the trie. Generation n only has
+ * to be computed when two keys share all of those bits. It reseeds the
+ * hash instead of deriving from generation 0, so that a collision in one
+ * generation does not carry over into the next.
+ */
+namespace fast_hash {
+
+static const uint64_t SECRET[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t r = a;
+    r *= b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+static inline uint64_t read8(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read4(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t bytes(const void *key, size_t len, uint64_t seed) {
+    const uint8_t *p = static_cast<const uint8_t *>(key);
+    seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ SECRET[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ SECRET[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    __uint128_t r = a ^ SECRET[1];
+    r *= b ^ seed;
+    return mix(static_cast<uint64_t>(r) ^ SECRET[0] ^ len, static_cast<uint64_t>(r >> 64) ^ SECRET[1]);
+}
+
+static inline uint64_t integer(uint64_t x, uint64_t seed) {
+    return mix(x ^ seed ^ SECRET[0], mix(seed ^ SECRET[1], SECRET[2]) | 1);
+}
+
+} // namespace fast_hash
+
+// FastHash<T>()(key, seed) -> uint64_t. Specialise for your own key types.
+template <typename T, typename = void>
+struct FastHash;
+
+template <typename T>
+struct FastHash<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>> {
+    uint64_t operator()(T x, uint64_t seed) const {
+        return fast_hash::integer(static_cast<uint64_t>(x), seed);
+    }
+};
+
+template <>
+struct FastHash<std::string_view> {
+    uint64_t operator()(std::string_view s, uint64_t seed) const {
+        return fast_hash::bytes(s.data(), s.size(), seed);
+    }
+};
+
+template <>
+struct FastHash<std::string> : FastHash<std::string_view> {};
+
+template <>
+struct FastHash<const char *> : FastHash<std::string_view> {};
+
+template <>
+struct FastHash<char *> : FastHash<std::string_view> {};
+
+template <size_t N>
+struct FastHash<char[N]> : FastHash<std::string_view> {};
+
+template <typename... Ts>
+struct FastHash<std::tuple<Ts...>> {
+    uint64_t operator()(const std::tuple<Ts...> & t, uint64_t seed) const {
+        std::apply([&seed](const Ts &... e) {
+            ((seed = FastHash<Ts>()(e, seed)), ...);
+        }, t);
+        return seed;
+    }
+};
+
+template <typename A, typename B>
+struct FastHash<std::pair<A, B>> {
+    uint64_t operator()(const std::pair<A, B> & p, uint64_t seed) const {
+        return FastHash<B>()(p.second, FastHash<A>()(p.first, seed));
+    }
+};
+
+// Transparent: a std::string, std::string_view and const char* with the
+// same bytes hash the same.
+template <uint64_t Seed = 0>
+struct FastHasher {
+    using is_transparent = void;
+
+    template <typename T>
+    size_t operator()(const T & key, size_t n) const {
+        return FastHash<T>()(key, Seed + n * fast_hash::SECRET[3]);
+    }
+};
+
+// Inline storage for the compact form of a HAMT: up to N values kept in
+// one flat array inside the HAMT object itself. Each entry carries a stamp
+// that stands in for leaf identity in three-way merges.
+template <typename Value, size_t N>
+struct HAMTSmall {
+    size_t used = 0;
+    uint64_t stamps[N];
+    alignas(Value) unsigned char storage[N * sizeof(Value)];
+
+    HAMTSmall() {}
+    HAMTSmall(const HAMTSmall &) = delete;
+    HAMTSmall & operator=(const HAMTSmall &) = delete;
+
+    ~HAMTSmall() {
+        for (size_t i = 0; i < used; ++i) {
+            at(i).~Value();
+        }
+    }
+
+    const Value & at(size_t i) const {
+        return *std::launder(reinterpret_cast<const Value *>(storage) + i);
+    }
+
+    void push_back(const Value & v, uint64_t stamp) {
+        new (storage + used * sizeof(Value)) Value(v);
+        stamps[used++] = stamp;
+    }
+
+    void push_back(Value && v, uint64_t stamp) {
+        new (storage + used * sizeof(Value)) Value(std::move(v));
+        stamps[used++] = stamp;
+    }
+};
+
+template <typename Value>
+struct HAMTSmall<Value, 0> {};
+
+/*
+ * SmallSize > 0 enables the compact form: a version with at most SmallSize
+ * entries keeps them inline in the HAMT object, with no Node, no vector
+ * and no per-value allocation. It is promoted to the trie on the insert
+ * that would overflow, and demoted again once removals bring it down to
+ * SmallSize / 2, so that alternating insert/remove at the boundary does
+ * not rebuild every time. Values must be copyable for this.
+ */
+template <
+    typename Value,
+    typename KeyExtractor,
+    typename Hasher = FastHasher<>,
+    typename Comp = std::equal_to<
+        std::invoke_result_t<KeyExtractor, Value>
+    >,
+    size_t SmallSize = 0,
+    typename Policy = AtomicRefCount<>
+>
+class HAMT : private HAMTSmall<Value, SmallSize> {
+    static_assert(SmallSize == 0 || std::is_copy_constructible_v<Value>,
+                  "the compact form copies values");
+public:
+    template <typename T>
+    using Ptr = typename Policy::template Ptr<T>;
+    template <typename T>
+    using Weak = typename Policy::template Weak<T>;
+
+    using Pointer = Ptr<const HAMT>;
+    using ValuePtr = Ptr<const Value>;
+private:
+    using K = std::invoke_result_t<KeyExtractor, Value>;
+    struct Node;
+    using NodePtr = Ptr<const Node>;
+    enum {
+        INDEX_LEAF = 0,
+        INDEX_NODE = 1
+    };
+    using VariantPtr = std::variant<ValuePtr, NodePtr>; // order is important
+    using Elements = std::vector<VariantPtr, typename Policy::template Allocator<VariantPtr>>;
+
+    static const size_t PERIOD = sizeof(size_t) * 8 / 6;
+
+    static inline size_t gitBits(size_t hashcode,  size_t level) {
+        return (hashcode >> (6 * (level % PERIOD))) & 63;
+    }
+
+    static inline uint64_t lshift(size_t i) {
+        return ((uint64_t)1) << i;
+    }
+
+    struct Node : public Policy::template EnableShared<Node> {
+        uint64_t bitmap;
+        Elements elements;
+
+        Node(uint64_t b, Elements && e)
+            : bitmap(b), elements(std::move(e)) {}
+        Node() : bitmap(0) {}
+
+        inline size_t InnerIndex(size_t i) const {
+            return __builtin_popcountll(bitmap & (lshift(i) - 1));
+        }
+
+        // borrowed; no reference count is touched
+        const VariantPtr * slot(size_t i) const {
+            assert( i < 64 );
+            return (lshift(i) & bitmap) ? &elements[InnerIndex(i)] : nullptr;
+        }
+
+        std::optional< VariantPtr > get(size_t i) const {
+            assert( i < 64 );
+            if (lshift(i) & bitmap) {
+                return elements[InnerIndex(i)];
+            } else {
+                return std::nullopt;
+            }
+        }
+
+        size_t size() const {
+            return elements.size();
+        }
+
+        NodePtr set(size_t i, VariantPtr kid) const {
+            assert( i < 64 );
+            if (lshift(i) & bitmap) {
+                if (kid != elements[InnerIndex(i)]) {
+                    counters::path_copy(elements.size() - 1);
+                    Elements e(elements);
+                    e[InnerIndex(i)] = kid;
+                    return Policy::template make<Node>(bitmap, std::move(e));
+                } else {
+                    return this->shared_from_this();
+                }
+            } else {
+                counters::path_copy(elements.size());
+                size_t cnt = InnerIndex(i);
+                Elements e(elements.size() + 1);
+                std::copy(elements.begin(), elements.begin() + cnt, e.begin());
+                e[cnt] = kid;
+                std::copy(elements.begin() + cnt, elements.end(), e.begin() + cnt + 1);
+                return Policy::template make<Node>(bitmap | lshift(i), std::move(e));
+            }
+        }
+
+        NodePtr clear(size_t i) const {
+            assert( i < 64 );
+            if (lshift(i) & bitmap) {
+                counters::path_copy(elements.size() - 1);
+                size_t index = InnerIndex(i);
+                Elements e(elements.size() - 1);
+                std::copy(elements.begin(), elements.begin() + index, e.begin());
+                std::copy(elements.begin() + index + 1, elements.end(), e.begin() + index);
+                return Policy::template make<const Node>(bitmap & ~(lshift(i)), std::move(e));
+            } else {
+                return this->shared_from_this();
+            }
+        }
+    };
+
+
+    NodePtr root_;   // null in the compact form
+    size_t size_;
+
+    using Small = HAMTSmall<Value, SmallSize>;
+
+    const Small & small() const {
+        return *this;
+    }
+
+    static uint64_t nextStamp() {
+        static std::atomic<uint64_t> stamp{0};
+        return stamp.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename Q>
+    static const ValuePtr * findLeaf(const Node * p, const Q & key) {
+        size_t hashcode = Hasher()(key, 0);
+        size_t level = 0;
+        while (1) {
+            const VariantPtr * vp = p->slot(gitBits(hashcode, level));
+            if (!vp) {
+                return nullptr;
+            }
+            if (auto leaf = std::get_if<INDEX_LEAF>(vp)) {
+                return Comp()(key, KeyExtractor()(**leaf)) ? leaf : nullptr;
+            }
+            p = std::get<INDEX_NODE>(*vp).get();
+            ++level;
+            if (level % PERIOD == 0) {
+                hashcode = Hasher()(key, level / PERIOD);
+            }
+        }
+    }
+
+    // the trie form of a version; compact entries get fresh leaves
+    static NodePtr trieRoot(const Pointer & hamt) {
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                NodePtr root = Policy::template make<Node>();
+                bool replaced = false;
+                for (size_t i = 0; i < hamt->small().used; ++i) {
+                    auto leaf = Policy::template make<const Value>(hamt->small().at(i));
+                    root = insert(root, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
+                }
+                return root;
+            }
+        }
+        return hamt->root_;
+    }
+
+    static Pointer demote(const NodePtr & root, size_t size) {
+        auto p = Policy::template make<HAMT>();
+        for_each(root, [&p](const Value & v) {
+            p->push_back(v, nextStamp());
+        });
+        p->size_ = size;
+        return p;
+    }
+
+    template <typename V>
+    static std::pair<Pointer, ValuePtr> insertSmall(const Pointer & hamt, V && value) {
+        const auto & s = hamt->small();
+        size_t found = s.used;
+        for (size_t i = 0; i < s.used; ++i) {
+            if (Comp()(KeyExtractor()(value), KeyExtractor()(s.at(i)))) {
+                found = i;
+                break;
+            }
+        }
+        if (found == s.used && s.used == SmallSize) {
+            auto root = trieRoot(hamt);
+            auto leaf = Policy::template make<const Value>(std::forward<V>(value));
+            bool replaced = false;
+            root = insert(root, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
+            return std::make_pair(Policy::template make<HAMT>(root, s.used + 1), leaf);
+        }
+        auto p = Policy::template make<HAMT>();
+        for (size_t i = 0; i < s.used; ++i) {
+            if (i == found) {
+                p->push_back(std::forward<V>(value), nextStamp());
+            } else {
+                p->push_back(s.at(i), s.stamps[i]);
+            }
+        }
+        if (found == s.used) {
+            p->push_back(std::forward<V>(value), nextStamp());
+        }
+        p->size_ = p->used;
+        return std::make_pair(Pointer(p), ValuePtr(p, &p->at(found)));
+    }
+
+public:
+    // any key type is accepted for lookups when both Hasher and Comp are
+    // transparent; otherwise only K itself
+    template <typename Q>
+    using EnableLookup = std::enable_if_t<
+        std::is_same_v<Q, std::decay_t<K>> ||
+        (is_transparent<Hasher>::value && is_transparent<Comp>::value)
+    >;
+
+    HAMT() : root_(SmallSize > 0 ? nullptr : Policy::template make<Node>()), size_(0) {}
+    HAMT(const NodePtr & r, size_t s) : root_(r), size_(s) {}
+
+    static Pointer create() {
+        return Policy::template make<HAMT>();
+    }
+
+    static size_t size(const Pointer & hamt) {
+        return hamt->size_;
+    }
+
+    static ValuePtr find(const Pointer & hamt, const K & key) {
+        return find<std::decay_t<K>>(hamt, key);
+    }
+
+    template <typename Q, typename = EnableLookup<Q>>
+    static ValuePtr find(const Pointer & hamt, const Q & key) {
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                auto v = find_ptr(hamt, key);
+                return v ? ValuePtr(hamt, v) : nullptr;
+            }
+        }
+        auto leaf = findLeaf(hamt->root_.get(), key);
+        return leaf ? *leaf : nullptr;
+    }
+
+    // Borrowed lookup, valid while `hamt` is held; see ownership.h.
+    static const Value * find_ptr(const Pointer & hamt, const K & key) {
+        return find_ptr<std::decay_t<K>>(hamt, key);
+    }
+
+    template <typename Q, typename = EnableLookup<Q>>
+    static const Value * find_ptr(const Pointer & hamt, const Q & key) {
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                const auto & s = hamt->small();
+                for (size_t i = 0; i < s.used; ++i) {
+                    if (Comp()(key, KeyExtractor()(s.at(i)))) {
+                        return &s.at(i);
+                    }
+                }
+                return nullptr;
+            }
+        }
+        auto leaf = findLeaf(hamt->root_.get(), key);
+        return leaf ? leaf->get() : nullptr;
+    }
+
+    // find as it was before the borrowed walk: every node on the path is
+    // copied out through Node::get, an atomic increment and decrement on a
+    // node all readers share. Kept as the baseline of bench_read_scaling.
+    static ValuePtr find_copying(const Pointer & hamt, const K & key) {
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                return find(hamt, key);
+            }
+        }
+        NodePtr p = hamt->root_;
+        size_t hashcode = Hasher()(key, 0);
+        for (size_t level = 0;; ) {
+            auto vp = p->get(gitBits(hashcode, level));
+            if (!vp) {
+                return nullptr;
+            }
+            if (vp->index() == INDEX_LEAF) {
+                auto & leaf = std::get<INDEX_LEAF>(*vp);
+                return Comp()(key, KeyExtractor()(*leaf)) ? leaf : nullptr;
+            }
+            p = std::get<INDEX_NODE>(*vp);
+            ++level;
+            if (level % PERIOD == 0) {
+                hashcode = Hasher()(key, level / PERIOD);
+            }
+        }
+    }
+
+    static bool contains(const Pointer & hamt, const K & key) {
+        return find_ptr(hamt, key) != nullptr;
+    }
+
+    template <typename Q, typename = EnableLookup<Q>>
+    static bool contains(const Pointer & hamt, const Q & key) {
+        return find_ptr(hamt, key) != nullptr;
+    }
+
+    static Pointer remove(const Pointer & hamt, const K & key) {
+        return remove<std::decay_t<K>>(hamt, key);
+    }
+
+    template <typename Q, typename = EnableLookup<Q>>
+    static Pointer remove(const Pointer & hamt, const Q & key) {
+        counters::Scope scope(counters::REMOVE);
+        struct Frame {
+            NodePtr node;
+            size_t bits;
+            Frame(NodePtr n, size_t b) : node(n), bits(b) {}
+        };
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                const auto & s = hamt->small();
+                for (size_t i = 0; i < s.used; ++i) {
+                    if (Comp()(key, KeyExtractor()(s.at(i)))) {
+                        auto p = Policy::template make<HAMT>();
+                        for (size_t j = 0; j < s.used; ++j) {
+                            if (j != i) {
+                                p->push_back(s.at(j), s.stamps[j]);
+                            }
+                        }
+                        p->size_ = p->used;
+                        return p;
+                    }
+                }
+                return hamt;
+            }
+        }
+
+        std::vector<Frame> stack;
+        bool removed = false;
+
+        {
+            auto p = hamt->root_;
+            size_t hashcode = Hasher()(key, 0);
+            size_t level = 0;
+            while (1) {
+                counters::descend();
+                size_t bits = gitBits(hashcode, level);
+                stack.emplace_back(p, bits);
+                auto vp = p->get(bits);
+                if (vp) {
+                    if (vp->index() == INDEX_LEAF) {
+                        if (Comp()(key, KeyExtractor()(*std::get<INDEX_LEAF>(*vp)))) {
+                            removed = true;
+                            break;
+                        }
+                    } else {
+                        p = std::get<INDEX_NODE>(*vp);
+                    }
+                } else {
+                    break;
+                }
+                ++level;
+                if (level % PERIOD == 0) {
+                    counters::count(counters::REHASH);
+                    hashcode = Hasher()(key, level / PERIOD);
+                }
+            }
+        }
+
+        if (removed) {
+            NodePtr p;
+            const auto & lastNode = stack.back().node;
+            const auto & lastBits = stack.back().bits;
+            VariantPtr t;
+            if (stack.size() > 1 && lastNode->elements.size() == 2 && (t = lastNode->elements[1 - lastNode->InnerIndex(lastBits)]).index() == INDEX_LEAF) {
+                stack.pop_back();
+                while (stack.size() > 1 && stack.back().node->elements.size() == 1) {
+                    stack.pop_back();
+                }
+                p = stack.back().node->set(stack.back().bits, t);
+                stack.pop_back();
+            } else {
+                p = lastNode->clear(lastBits);
+                stack.pop_back();
+            }
+            while (!stack.empty()) {
+                p = stack.back().node->set(stack.back().bits, p);
+                stack.pop_back();
+            }
+            if constexpr (SmallSize > 0) {
+                if (hamt->size_ - 1 <= SmallSize / 2) {
+                    return demote(p, hamt->size_ - 1);
+                }
+            }
+            counters::count(counters::ALLOC);
+            return Policy::template make<HAMT>(p, hamt->size_ - 1);
+        } else {
+            return hamt;
+        }
+    }
+
+
+    static NodePtr merge(const ValuePtr & a, size_t hash_a, const ValuePtr & b, size_t hash_b, size_t level) {
+        size_t bits_a = gitBits(hash_a, level);
+        size_t bits_b = gitBits(hash_b, level);
+        if (bits_a == bits_b) {
+            if ((level + 1) % PERIOD == 0) {
+                counters::count(counters::REHASH, 2);
+                hash_a = Hasher()(KeyExtractor()(*a), (level + 1) / PERIOD);
+                hash_b = Hasher()(KeyExtractor()(*b), (level + 1) / PERIOD);
+            }
+            counters::descend();
+            counters::count(counters::ALLOC);
+            auto p = merge(a, hash_a, b, hash_b, level + 1);
+            Elements elements = {p,};
+            return Policy::template make<Node>(lshift(bits_a), std::move(elements));
+        } else {
+            uint64_t bitmap = lshift(bits_a) | lshift(bits_b);
+            counters::count(counters::ALLOC);
+            if (bits_a < bits_b) {
+                return Policy::template make<Node>(bitmap, Elements{a, b});
+            } else {
+                return Policy::template make<Node>(bitmap, Elements{b, a});
+            }
+        }
+    }
+
+    static NodePtr insert(const NodePtr & root, const ValuePtr & leaf, size_t hashcode, size_t level, bool & replaced) {
+        counters::descend();
+        size_t bits = gitBits(hashcode, level);
+        auto vp = root->get(bits);
+
+        if (!vp) {
+            return root->set(bits, leaf);
+        } else {
+            if (vp->index() == INDEX_NODE) {
+                if ((level + 1) % PERIOD == 0) {
+                    counters::count(counters::REHASH);
+                    hashcode = Hasher()(KeyExtractor()(*leaf), (level + 1) / PERIOD);
+                }
+                auto p = insert(std::get<INDEX_NODE>(*vp), leaf, hashcode, level + 1, replaced);
+                return root->set(bits, p);
+            } else {
+                auto old_leaf = std::get<INDEX_LEAF>(*vp);
+                if (Comp()(KeyExtractor()(*leaf), KeyExtractor()(*old_leaf))) {
+                    replaced = true;
+                    return root->set(bits, leaf);
+                } else {
+                    counters::count(counters::REHASH);
+                    size_t old_leaf_hash = Hasher()(KeyExtractor()(*old_leaf), (level + 1) / PERIOD);
+                    if ((level + 1) % PERIOD == 0) {
+                        counters::count(counters::REHASH);
+                        hashcode = Hasher()(KeyExtractor()(*leaf), (level + 1) / PERIOD);
+                    }
+                    auto p = merge(old_leaf, old_leaf_hash, leaf, hashcode, level + 1);
+                    return root->set(bits, p);
+                }
+            }
+        }
+    }
+
+    static Pointer insert(const Pointer & hamt, Value && value) {
+        counters::Scope scope(counters::INSERT);
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                return insertSmall(hamt, std::move(value)).first;
+            }
+        }
+        auto leaf = Policy::template make<Value>(std::move(value));
+        bool replaced = false;
+        counters::count(counters::ALLOC, 2);   // the leaf and the new version
+        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
+        size_t size = hamt->size_;
+        if (!replaced) {
+            ++size;
+        }
+        return Policy::template make<HAMT>(root, size);
+    }
+
+    static Pointer insert(const Pointer & hamt, const Value & value) {
+        counters::Scope scope(counters::INSERT);
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                return insertSmall(hamt, value).first;
+            }
+        }
+        auto leaf = Policy::template make<Value>(value);
+        bool replaced = false;
+        counters::count(counters::ALLOC, 2);   // the leaf and the new version
+        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(value), 0), 0, replaced);
+        size_t size = hamt->size_;
+        if (!replaced) {
+            ++size;
+        }
+        return Policy::template make<HAMT>(root, size);
+    }
+
+    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & hamt, const Value & value) {
+        counters::Scope scope(counters::INSERT);
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                return insertSmall(hamt, value);
+            }
+        }
+        auto leaf = Policy::template make<Value>(value);
+        bool replaced = false;
+        counters::count(counters::ALLOC, 2);   // the leaf and the new version
+        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
+        size_t size = hamt->size_;
+        if (!replaced) {
+            ++size;
+        }
+        return std::make_pair(Policy::template make<HAMT>(root, size), leaf);
+    }
+
+    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & hamt, Value && value) {
+        counters::Scope scope(counters::INSERT);
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                return insertSmall(hamt, std::move(value));
+            }
+        }
+        auto leaf = Policy::template make<Value>(std::move(value));
+        bool replaced = false;
+        counters::count(counters::ALLOC, 2);   // the leaf and the new version
+        const auto & root = insert(hamt->root_, leaf, Hasher()(KeyExtractor()(*leaf), 0), 0, replaced);
+        size_t size = hamt->size_;
+        if (!replaced) {
+            ++size;
+        }
+        return std::make_pair(Policy::template make<HAMT>(root, size), leaf);
+    }
+
+    template <typename Callable>
+    static void for_each(const NodePtr & root, const Callable & callback) {
+        uint64_t bitmap = root->bitmap;
+        while (bitmap) {
+            int k = __builtin_ctzll(bitmap);
+            const auto & p = root->get(k);
+            assert (p);
+            if (p->index() == INDEX_LEAF) {
+                callback(*std::get<INDEX_LEAF>(*p));
+            } else {
+                for_each(std::get<INDEX_NODE>(*p), callback);
+            }
+            bitmap = bitmap & (bitmap - 1);
+        }
+    }
+
+    template <typename Callable>
+    static void for_each(const Pointer & hamt, const Callable & callback) {
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                for (size_t i = 0; i < hamt->small().used; ++i) {
+                    callback(hamt->small().at(i));
+                }
+                return;
+            }
+        }
+        for_each(hamt->root_, callback);
+    }
+
+    // for_each over the values no other owner can reach: the walk stops at
+    // the version, node or leaf whose use count is above one. Summed over
+    // every holder of every version, each value is visited at most once,
+    // which is what a cycle collector's traversal needs.
+    template <typename Callable>
+    static void for_each_owned(const Pointer & hamt, const Callable & callback) {
+        if (hamt.use_count() != 1) {
+            return;
+        }
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                for_each(hamt, callback);
+                return;
+            }
+        }
+        forEachOwned(hamt->root_, callback);
+    }
+
+    /*
+     * Three-way merge.
+     *
+     * merge3 applies the changes made between `base` and `ours` to `theirs`.
+     * Slots whose pointers are identical on two sides are resolved without
+     * descending, so the cost is proportional to what both sides changed. A
+     * key counts as a conflict only if both sides changed it and ended up with
+     * different leaves.
+     */
+    struct Conflict {
+        ValuePtr base;
+        ValuePtr ours;
+        ValuePtr theirs;
+    };
+
+private:
+    template <typename Callable>
+    static void forEachOwned(const NodePtr & node, const Callable & callback) {
+        if (node.use_count() != 1) {
+            return;
+        }
+        for (const auto & e : node->elements) {
+            if (e.index() == INDEX_NODE) {
+                forEachOwned(std::get<INDEX_NODE>(e), callback);
+            } else if (std::get<INDEX_LEAF>(e).use_count() == 1) {
+                callback(*std::get<INDEX_LEAF>(e));
+            }
+        }
+    }
+
+    using Slot = std::optional< VariantPtr >;
+
+    static Slot getSlot(const NodePtr & node, size_t i) {
+        return node ? node->get(i) : std::nullopt;
+    }
+
+    static ValuePtr slotLeaf(const Slot & s) {
+        return s && s->index() == INDEX_LEAF ? std::get<INDEX_LEAF>(*s) : nullptr;
+    }
+
+    static size_t count(const Slot & s) {
+        if (!s) {
+            return 0;
+        } else if (s->index() == INDEX_LEAF) {
+            return 1;
+        } else {
+            size_t n = 0;
+            for (const auto & e : std::get<INDEX_NODE>(*s)->elements) {
+                n += count(e);
+            }
+            return n;
+        }
+    }
+
+    // count(a) - count(b), skipping subtrees they share
+    static ptrdiff_t leafDiff(const Slot & a, const Slot & b) {
+        if (a == b) {
+            return 0;
+        }
+        if (a && b && a->index() == INDEX_NODE && b->index() == INDEX_NODE) {
+            const auto & na = std::get<INDEX_NODE>(*a);
+            const auto & nb = std::get<INDEX_NODE>(*b);
+            ptrdiff_t d = 0;
+            uint64_t bitmap = na->bitmap | nb->bitmap;
+            while (bitmap) {
+                int k = __builtin_ctzll(bitmap);
+                d += leafDiff(na->get(k), nb->get(k));
+                bitmap = bitmap & (bitmap - 1);
+            }
+            return d;
+        }
+        return static_cast<ptrdiff_t>(count(a)) - static_cast<ptrdiff_t>(count(b));
+    }
+
+    // view a slot at `level` as a node, so that it can be merged slot by slot
+    static NodePtr promote(const Slot & s, size_t level) {
+        if (!s) {
+            return nullptr;
+        } else if (s->index() == INDEX_NODE) {
+            return std::get<INDEX_NODE>(*s);
+        } else {
+            const auto & leaf = std::get<INDEX_LEAF>(*s);
+            size_t bits = gitBits(Hasher()(KeyExtractor()(*leaf), level / PERIOD), level);
+            return Policy::template make<Node>(lshift(bits), Elements{leaf});
+        }
+    }
+
+    static NodePtr mergeNodes(const NodePtr & b, const NodePtr & o, const NodePtr & t, size_t level,
+                              ptrdiff_t & delta, std::vector<Conflict> & conflicts) {
+        uint64_t bitmap = (b ? b->bitmap : 0) | (o ? o->bitmap : 0) | (t ? t->bitmap : 0);
+        uint64_t result = 0;
+        Elements e;
+        while (bitmap) {
+            int k = __builtin_ctzll(bitmap);
+            auto s = mergeSlots(getSlot(b, k), getSlot(o, k), getSlot(t, k), level + 1, delta, conflicts);
+            if (s) {
+                result |= lshift(k);
+                e.push_back(std::move(*s));
+            }
+            bitmap = bitmap & (bitmap - 1);
+        }
+        if (t && t->bitmap == result && t->elements == e) {
+            return t;
+        }
+        if (o && o->bitmap == result && o->elements == e) {
+            return o;
+        }
+        return Policy::template make<Node>(result, std::move(e));
+    }
+
+    static Slot mergeSlots(const Slot & b, const Slot & o, const Slot & t, size_t level,
+                           ptrdiff_t & delta, std::vector<Conflict> & conflicts) {
+        if (o == b) {
+            return t;
+        }
+        if (t == b) {
+            delta += leafDiff(o, b);
+            return o;
+        }
+        if (o == t) {
+            return o;
+        }
+
+        const Slot *slots[] = {&b, &o, &t};
+        const Value *leaf = nullptr;
+        bool sameKey = true;
+        for (const Slot *s : slots) {
+            if (!*s) {
+                continue;
+            }
+            if ((*s)->index() == INDEX_NODE) {
+                sameKey = false;
+                break;
+            }
+            const auto & v = *std::get<INDEX_LEAF>(**s);
+            if (!leaf) {
+                leaf = &v;
+            } else if (!Comp()(KeyExtractor()(*leaf), KeyExtractor()(v))) {
+                sameKey = false;
+                break;
+            }
+        }
+        if (sameKey) {
+            conflicts.push_back(Conflict{slotLeaf(b), slotLeaf(o), slotLeaf(t)});
+            return t;
+        }
+
+        auto p = mergeNodes(promote(b, level), promote(o, level), promote(t, level), level, delta, conflicts);
+        if (p->size() == 0) {
+            return std::nullopt;
+        } else if (p->size() == 1 && p->elements[0].index() == INDEX_LEAF) {
+            return p->elements[0];
+        } else {
+            return VariantPtr(p);
+        }
+    }
+
+    // A key's state in one version: compact entries are identified by their
+    // stamp, trie leaves by address. Across the two forms identity is lost,
+    // so equal values (where Value has ==) count as the same.
+    struct KeyState {
+        ValuePtr value;
+        uint64_t id = 0;
+        bool stamped = false;
+
+        bool operator==(const KeyState & o) const {
+            if (!value || !o.value) {
+                return !value && !o.value;
+            }
+            if (stamped == o.stamped) {
+                return id == o.id;
+            }
+            if constexpr (has_equal<Value>::value) {
+                return *value == *o.value;
+            } else {
+                return false;
+            }
+        }
+    };
+
+    template <typename Q>
+    static KeyState keyState(const Pointer & hamt, const Q & key) {
+        KeyState k;
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                const auto & s = hamt->small();
+                for (size_t i = 0; i < s.used; ++i) {
+                    if (Comp()(key, KeyExtractor()(s.at(i)))) {
+                        k.value = ValuePtr(hamt, &s.at(i));
+                        k.id = s.stamps[i];
+                        k.stamped = true;
+                        break;
+                    }
+                }
+                return k;
+            }
+        }
+        k.value = find(hamt, key);
+        k.id = reinterpret_cast<uintptr_t>(k.value.get());
+        return k;
+    }
+
+    // Key-by-key merge, used when any side is in the compact form.
+    static Pointer mergeKeys(const Pointer & base, const Pointer & ours, const Pointer & theirs,
+                             std::vector<Conflict> & conflicts) {
+        Pointer result = theirs;
+        auto apply = [&](const auto & key) {
+            auto b = keyState(base, key);
+            auto o = keyState(ours, key);
+            if (o == b) {
+                return;
+            }
+            auto t = keyState(theirs, key);
+            if (t == b) {
+                result = o.value ? insert(result, *o.value) : remove(result, key);
+            } else if (!(o == t)) {
+                conflicts.push_back(Conflict{b.value, o.value, t.value});
+            }
+        };
+        for_each(ours, [&](const Value & v) {
+            apply(KeyExtractor()(v));
+        });
+        for_each(base, [&](const Value & v) {
+            if (!keyState(ours, KeyExtractor()(v)).value) {
+                apply(KeyExtractor()(v));
+            }
+        });
+        return result;
+    }
+
+public:
+    static Pointer merge3(const Pointer & base, const Pointer & ours, const Pointer & theirs,
+                          std::vector<Conflict> & conflicts) {
+        counters::Scope scope(counters::MERGE);
+        if (ours == base) {
+            return theirs;
+        }
+        if (theirs == base) {
+            return ours;
+        }
+        if constexpr (SmallSize > 0) {
+            if (!base->root_ || !ours->root_ || !theirs->root_) {
+                return mergeKeys(base, ours, theirs, conflicts);
+            }
+        }
+        if (ours->root_ == base->root_) {
+            return theirs;
+        }
+        if (theirs->root_ == base->root_) {
+            return ours;
+        }
+        ptrdiff_t delta = 0;
+        auto root = mergeNodes(base->root_, ours->root_, theirs->root_, 0, delta, conflicts);
+        return Policy::template make<HAMT>(root, theirs->size_ + delta);
+    }
+
+    // A published version that transactions commit to with a single swap.
+    // The std::atomic_* free functions on shared_ptr are not lock-free:
+    // libstdc++ serialises each load, store and exchange on a mutex picked
+    // from a small pool by address. The critical section is only the pointer
+    // copy and one reference count update, but readers of one Root do contend
+    // on it.
+    class Root {
+        Pointer current_;
+    public:
+        explicit Root(const Pointer & p = create()) : current_(p) {}
+
+        Pointer load() const {
+            return std::atomic_load(&current_);
+        }
+
+        void store(const Pointer & p) {
+            std::atomic_store(&current_, p);
+        }
+
+        bool compare_exchange(Pointer & expected, const Pointer & desired) {
+            return std::atomic_compare_exchange_strong(&current_, &expected, desired);
+        }
+    };
+
+    // Optimistic multi-key transaction. Changes are built against a private
+    // copy of `base`; commit merges them into whatever the root holds by then.
+    class Transaction {
+        Pointer base_;
+        Pointer working_;
+    public:
+        explicit Transaction(const Pointer & base) : base_(base), working_(base) {}
+        explicit Transaction(const Root & root) : Transaction(root.load()) {}
+
+        const Pointer & base() const {
+            return base_;
+        }
+
+        const Pointer & snapshot() const {
+            return working_;
+        }
+
+        ValuePtr find(const K & key) const {
+            return HAMT::find(working_, key);
+        }
+
+        template <typename Q, typename = EnableLookup<Q>>
+        ValuePtr find(const Q & key) const {
+            return HAMT::find(working_, key);
+        }
+
+        void insert(Value && value) {
+            working_ = HAMT::insert(working_, std::move(value));
+        }
+
+        void insert(const Value & value) {
+            working_ = HAMT::insert(working_, value);
+        }
+
+        void remove(const K & key) {
+            working_ = HAMT::remove(working_, key);
+        }
+
+        template <typename Q, typename = EnableLookup<Q>>
+        void remove(const Q & key) {
+            working_ = HAMT::remove(working_, key);
+        }
+
+        // On success the root holds the merged version and the transaction
+        // is rebased onto it. On conflict nothing is published and the
+        // conflicting keys are appended to `conflicts`.
+        bool commit(Root & root, std::vector<Conflict> & conflicts) {
+            auto current = root.load();
+            while (1) {
+                std::vector<Conflict> found;
+                auto merged = merge3(base_, working_, current, found);
+                if (!found.empty()) {
+                    conflicts.insert(conflicts.end(), found.begin(), found.end());
+                    return false;
+                }
+                if (root.compare_exchange(current, merged)) {
+                    base_ = merged;
+                    working_ = merged;
+                    return true;
+                }
+            }
+        }
+
+        bool commit(Root & root) {
+            std::vector<Conflict> conflicts;
+            return commit(root, conflicts);
+        }
+    };
+
+    /*
+     * Memory and shape statistics.
+     *
+     * bytes counts the HAMT wrapper, every node (including unused vector
+     * capacity) and every leaf, each with its shared_ptr control block.
+     * Memory owned by a Value itself is included only when a valueBytes
+     * callable is given.
+     */
+    struct Stats {
+        size_t nodes = 0;
+        size_t leaves = 0;
+        size_t bytes = 0;
+        std::vector<size_t> depth;    // depth[d]: leaves held by a node d levels below the root
+        std::vector<size_t> fanout;   // fanout[k]: nodes with k elements
+    };
+
+private:
+    static size_t nodeBytes(const Node & node) {
+        return CONTROL_BLOCK_BYTES + sizeof(Node) + node.elements.capacity() * sizeof(VariantPtr);
+    }
+
+    template <typename Callable>
+    static size_t leafBytes(const Value & value, const Callable & valueBytes) {
+        return CONTROL_BLOCK_BYTES + sizeof(Value) + valueBytes(value);
+    }
+
+    template <typename Callable>
+    static void stats(const NodePtr & node, size_t depth, Stats & s, const Callable & valueBytes) {
+        ++s.nodes;
+        s.bytes += nodeBytes(*node);
+        ++s.fanout[node->size()];
+        for (const auto & e : node->elements) {
+            if (e.index() == INDEX_LEAF) {
+                ++s.leaves;
+                s.bytes += leafBytes(*std::get<INDEX_LEAF>(e), valueBytes);
+                if (s.depth.size() <= depth) {
+                    s.depth.resize(depth + 1);
+                }
+                ++s.depth[depth];
+            } else {
+                stats(std::get<INDEX_NODE>(e), depth + 1, s, valueBytes);
+            }
+        }
+    }
+
+    // records the bytes of every subtree reachable from v, keyed by address
+    template <typename Callable>
+    static size_t subtreeBytes(const VariantPtr & v, std::unordered_map<const void *, size_t> & seen,
+                               const Callable & valueBytes) {
+        size_t bytes;
+        const void *addr;
+        if (v.index() == INDEX_LEAF) {
+            addr = std::get<INDEX_LEAF>(v).get();
+            bytes = leafBytes(*std::get<INDEX_LEAF>(v), valueBytes);
+        } else {
+            const auto & node = std::get<INDEX_NODE>(v);
+            addr = node.get();
+            bytes = nodeBytes(*node);
+            for (const auto & e : node->elements) {
+                bytes += subtreeBytes(e, seen, valueBytes);
+            }
+        }
+        seen.emplace(addr, bytes);
+        return bytes;
+    }
+
+    static size_t sharedBytes(const VariantPtr & v, const std::unordered_map<const void *, size_t> & seen) {
+        const void *addr = v.index() == INDEX_LEAF
+            ? static_cast<const void *>(std::get<INDEX_LEAF>(v).get())
+            : static_cast<const void *>(std::get<INDEX_NODE>(v).get());
+        auto it = seen.find(addr);
+        if (it != seen.end()) {
+            return it->second;
+        }
+        size_t bytes = 0;
+        if (v.index() == INDEX_NODE) {
+            for (const auto & e : std::get<INDEX_NODE>(v)->elements) {
+                bytes += sharedBytes(e, seen);
+            }
+        }
+        return bytes;
+    }
+
+public:
+    template <typename Callable>
+    static Stats stats(const Pointer & hamt, const Callable & valueBytes) {
+        Stats s;
+        s.fanout.resize(65);
+        s.bytes = CONTROL_BLOCK_BYTES + sizeof(HAMT);
+        if constexpr (SmallSize > 0) {
+            if (!hamt->root_) {
+                for_each(hamt, [&s, &valueBytes](const Value & v) {
+                    ++s.leaves;
+                    s.bytes += valueBytes(v);
+                });
+                if (s.leaves) {
+                    s.depth.push_back(s.leaves);
+                }
+                return s;
+            }
+        }
+        stats(hamt->root_, 0, s, valueBytes);
+        return s;
+    }
+
+    static Stats stats(const Pointer & hamt) {
+        return stats(hamt, [](const Value &) { return size_t(0); });
+    }
+
+    // Bytes of nodes and leaves reachable from both versions. Compact
+    // versions keep their entries inline and share nothing.
+    template <typename Callable>
+    static size_t shared_bytes(const Pointer & a, const Pointer & b, const Callable & valueBytes) {
+        if (!a->root_ || !b->root_) {
+            return 0;
+        }
+        std::unordered_map<const void *, size_t> seen;
+        subtreeBytes(a->root_, seen, valueBytes);
+        return sharedBytes(b->root_, seen);
+    }
+
+    static size_t shared_bytes(const Pointer & a, const Pointer & b) {
+        return shared_bytes(a, b, [](const Value &) { return size_t(0); });
+    }
+
+    static void toDot(const Pointer & hamt, std::ostream & os) {
+        os << "digraph {\n"
+          "graph [pad=\"0.5\", nodesep=\"0.5\", ranksep=\"2\"];\n"
+          "node [shape=plain]\n"
+          "rankdir=LR;\n\n";
+
+        _toDot(trieRoot(hamt), os);
+        os << "}\n";
+    }
+
+    static inline std::string addrToName(const void *p) {
+        std::stringstream ss;
+        ss << "node_" << p;
+        return ss.str();
+    }
+
+    static std::string _toDot(VariantPtr root, std::ostream & os) {
+        if (root.index() == INDEX_LEAF) {
+            std::stringstream ss;
+            const auto & leaf = *(std::get<INDEX_LEAF>(root));
+            ss << "leaf_" << KeyExtractor()(leaf);
+            return ss.str();
+        } else {
+            auto p = std::get<INDEX_NODE>(root);
+            std::string parent_name = addrToName(p.get());
+            os << parent_name << " [label=<\n"
+                    "  <table border=\"0\" cellborder=\"1\" cellspacing=\"0\">\n"
+                    "    <tr><td><b><i>" << parent_name << "</i></b></td></tr>\n";
+            
+            for (size_t i = 0; i < 64; ++i) {
+                auto e = p->get(i);
+                if (e) {
+                    os << "    <tr><td port=\"" << i << "\">" << i << "</td></tr>\n";
+                }
+            }
+            os << "  </table>>];\n";
+
+            for (size_t i = 0; i < 64; ++i) {
+                auto e = p->get(i);
+                if (e) {
+                    const auto & kid_name = _toDot(*e, os); 
+                    os << "    " << parent_name << ":" << i << " -> " << kid_name << "\n";
+                }
+            }
+            return parent_name;
+        }
+    }
+
+    /*
+     * Incremental checkpoints.
+     *
+     * The first time a node or leaf is written it gets a stable id. Later
+     * checkpoints only write objects that no earlier segment contains and
+     * refer to the rest by id. Each segment is therefore proportional to the
+     * change since the previous checkpoint, not to the size of the map.
+     *
+     * Segment layout (native byte order):
+     *   header   "HAMTSEG1" | first_id u64 | count u64
+     *   records  leaf: u8 INDEX_LEAF | len u64 | Codec::encode bytes
+     *            node: u8 INDEX_NODE | bitmap u64 | kid id u64 * popcount
+     *   table    record offset u64 * count
+     *   footer   table_offset u64 | root_id u64 | size u64 | "HAMTSEG1"
+     *
+     * Codec must provide
+     *   void encode(const Value &, std::string & out)   (append to out)
+     *   Value decode(const char * data, size_t len)
+     */
+private:
+    static constexpr char SEGMENT_MAGIC[8] = {'H', 'A', 'M', 'T', 'S', 'E', 'G', '1'};
+    static const size_t SEGMENT_HEADER = 24;
+    static const size_t SEGMENT_FOOTER = 32;
+
+    static inline void putU64(std::string & buf, uint64_t x) {
+        buf.append(reinterpret_cast<const char *>(&x), sizeof(x));
+    }
+
+    static inline uint64_t getU64(const char *p) {
+        uint64_t x;
+        std::memcpy(&x, p, sizeof(x));
+        return x;
+    }
+
+    struct Segment {
+        const char *data;
+        size_t length;
+        uint64_t first_id;
+        uint64_t count;
+        uint64_t table_offset;
+        uint64_t root_id;
+        uint64_t size;
+    };
+
+    static Segment parseSegment(const char *data, size_t length) {
+        if (length < SEGMENT_HEADER + SEGMENT_FOOTER
+            || std::memcmp(data, SEGMENT_MAGIC, 8) != 0
+            || std::memcmp(data + length - 8, SEGMENT_MAGIC, 8) != 0) {
+            throw std::runtime_error("bad checkpoint segment");
+        }
+        const char *footer = data + length - SEGMENT_FOOTER;
+        Segment s{data, length, getU64(data + 8), getU64(data + 16),
+                  getU64(footer), getU64(footer + 8), getU64(footer + 16)};
+        if (s.table_offset < SEGMENT_HEADER || s.table_offset > length - SEGMENT_FOOTER
+            || (length - SEGMENT_FOOTER - s.table_offset) / 8 != s.count) {
+            throw std::runtime_error("bad checkpoint segment table");
+        }
+        return s;
+    }
+
+    // The record with this id, checked to lie whole inside the record area:
+    // a truncated or corrupt segment throws instead of reading past it.
+    static const char * segmentRecord(const Segment & s, uint64_t id) {
+        if (id - s.first_id >= s.count) {
+            throw std::runtime_error("bad checkpoint reference");
+        }
+        uint64_t offset = getU64(s.data + s.table_offset + 8 * (id - s.first_id));
+        if (offset < SEGMENT_HEADER || offset > s.table_offset || s.table_offset - offset < 9) {
+            throw std::runtime_error("bad checkpoint record offset");
+        }
+        const char *r = s.data + offset;
+        uint64_t room = s.table_offset - offset - 9;
+        uint64_t need;
+        if (r[0] == INDEX_LEAF) {
+            need = getU64(r + 1);
+        } else if (r[0] == INDEX_NODE) {
+            need = 8 * __builtin_popcountll(getU64(r + 1));
+        } else {
+            throw std::runtime_error("bad checkpoint record type");
+        }
+        if (need > room) {
+            throw std::runtime_error("truncated checkpoint record");
+        }
+        return r;
+    }
+
+public:
+    template <typename Codec>
+    class CheckpointWriter {
+        struct Entry {
+            Weak<const void> object;
+            uint64_t id;
+        };
+        // keyed by address; the weak_ptr tells a live object apart from a
+        // dead one whose address was reused
+        std::unordered_map<const void *, Entry> ids_;
+        uint64_t next_id_ = 0;
+        size_t next_sweep_ = 1024;
+
+        using Fresh = std::vector< std::pair<Ptr<const void>, uint64_t> >;
+
+        uint64_t visit(const VariantPtr & v, std::string & buf, std::vector<uint64_t> & offsets, Fresh & fresh) {
+            Ptr<const void> object;
+            if (v.index() == INDEX_LEAF) {
+                object = std::get<INDEX_LEAF>(v);
+            } else {
+                object = std::get<INDEX_NODE>(v);
+            }
+            auto it = ids_.find(object.get());
+            if (it != ids_.end() && it->second.object.lock() == object) {
+                return it->second.id;
+            }
+
+            if (v.index() == INDEX_LEAF) {
+                std::string bytes;
+                Codec().encode(*std::get<INDEX_LEAF>(v), bytes);
+                offsets.push_back(buf.size());
+                buf.push_back(INDEX_LEAF);
+                putU64(buf, bytes.size());
+                buf.append(bytes);
+            } else {
+                const auto & node = std::get<INDEX_NODE>(v);
+                std::vector<uint64_t> kids;
+                kids.reserve(node->size());
+                for (const auto & e : node->elements) {
+                    kids.push_back(visit(e, buf, offsets, fresh));
+                }
+                offsets.push_back(buf.size());
+                buf.push_back(INDEX_NODE);
+                putU64(buf, node->bitmap);
+                for (auto id : kids) {
+                    putU64(buf, id);
+                }
+            }
+            uint64_t id = next_id_ + fresh.size();
+            fresh.emplace_back(std::move(object), id);
+            return id;
+        }
+
+        void sweep() {
+            for (auto it = ids_.begin(); it != ids_.end(); ) {
+                if (it->second.object.expired()) {
+                    it = ids_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            next_sweep_ = ids_.size() * 2 + 1024;
+        }
+
+    public:
+        // Writes the objects of `hamt` not present in any earlier segment of
+        // this writer to `path`. Returns the number of records written.
+        size_t write(const Pointer & hamt, const std::string & path) {
+            std::string buf(SEGMENT_MAGIC, 8);
+            putU64(buf, next_id_);
+            putU64(buf, 0);
+
+            std::vector<uint64_t> offsets;
+            Fresh fresh;
+            uint64_t root_id = visit(trieRoot(hamt), buf, offsets, fresh);
+            uint64_t count = offsets.size();
+            std::memcpy(&buf[16], &count, sizeof(count));
+
+            uint64_t table_offset = buf.size();
+            for (auto offset : offsets) {
+                putU64(buf, offset);
+            }
+            putU64(buf, table_offset);
+            putU64(buf, root_id);
+            putU64(buf, hamt->size_);
+            buf.append(SEGMENT_MAGIC, 8);
+
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(buf.data(), buf.size());
+            out.close();
+            if (!out) {
+                throw std::runtime_error("failed to write checkpoint " + path);
+            }
+
+            // ids only become visible once the segment holding them is on disk
+            for (auto & f : fresh) {
+                const void *addr = f.first.get();
+                ids_[addr] = Entry{f.first, f.second};
+            }
+            next_id_ += fresh.size();
+            if (ids_.size() >= next_sweep_) {
+                sweep();
+            }
+            return count;
+        }
+    };
+
+    // Rebuilds versions from a chain of segments. Segments must be loaded in
+    // the order they were written; every loaded object stays resident so later
+    // segments can share it.
+    template <typename Codec>
+    class CheckpointLoader {
+        std::vector<VariantPtr> objects_;
+
+    public:
+        Pointer load(const std::string & path) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("failed to open checkpoint " + path);
+            }
+            std::string buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            auto s = parseSegment(buf.data(), buf.size());
+            if (s.first_id != objects_.size()) {
+                throw std::runtime_error("checkpoint " + path + " is out of sequence");
+            }
+
+            auto kid = [this](uint64_t id) -> const VariantPtr & {
+                if (id >= objects_.size()) {
+                    throw std::runtime_error("bad checkpoint reference");
+                }
+                return objects_[id];
+            };
+
+            for (uint64_t i = 0; i < s.count; ++i) {
+                const char *r = segmentRecord(s, s.first_id + i);
+                if (r[0] == INDEX_LEAF) {
+                    objects_.emplace_back(std::in_place_index<INDEX_LEAF>,
+                        Policy::template make<const Value>(Codec().decode(r + 9, getU64(r + 1))));
+                } else {
+                    uint64_t bitmap = getU64(r + 1);
+                    Elements e;
+                    e.reserve(__builtin_popcountll(bitmap));
+                    for (int k = 0; k < __builtin_popcountll(bitmap); ++k) {
+                        e.push_back(kid(getU64(r + 9 + 8 * k)));
+                    }
+                    objects_.emplace_back(std::in_place_index<INDEX_NODE>,
+                        Policy::template make<const Node>(bitmap, std::move(e)));
+                }
+            }
+
+            const auto & root = kid(s.root_id);
+            if (root.index() != INDEX_NODE) {
+                throw std::runtime_error("checkpoint root is not a node");
+            }
+            return Policy::template make<HAMT>(std::get<INDEX_NODE>(root), s.size);
+        }
+    };
+
+    // Read-only lookups straight from mmap'ed segments, without rebuilding
+    // the version in memory. `paths` is the chain up to and including the
+    // segment whose root is wanted.
+    template <typename Codec>
+    class CheckpointView {
+        std::vector<Segment> segments_;
+
+        const char * record(uint64_t id) const {
+            auto it = std::upper_bound(segments_.begin(), segments_.end(), id,
+                [](uint64_t i, const Segment & s) { return i < s.first_id; });
+            if (it == segments_.begin() || id >= (it - 1)->first_id + (it - 1)->count) {
+                throw std::runtime_error("bad checkpoint reference");
+            }
+            return segmentRecord(*(it - 1), id);
+        }
+
+    public:
+        explicit CheckpointView(const std::vector<std::string> & paths) {
+            try {
+                for (const auto & path : paths) {
+                    int fd = ::open(path.c_str(), O_RDONLY);
+                    if (fd < 0) {
+                        throw std::runtime_error("failed to open checkpoint " + path);
+                    }
+                    struct stat st;
+                    void *data = MAP_FAILED;
+                    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                        data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    }
+                    ::close(fd);
+                    if (data == MAP_FAILED) {
+                        throw std::runtime_error("failed to map checkpoint " + path);
+                    }
+                    try {
+                        segments_.push_back(parseSegment(static_cast<const char *>(data), st.st_size));
+                    } catch (...) {
+                        ::munmap(data, st.st_size);
+                        throw;
+                    }
+                    uint64_t expect = segments_.size() == 1 ? 0 : segments_[segments_.size() - 2].first_id + segments_[segments_.size() - 2].count;
+                    if (segments_.back().first_id != expect) {
+                        throw std::runtime_error("checkpoint " + path + " is out of sequence");
+                    }
+                }
+                if (segments_.empty()) {
+                    throw std::runtime_error("empty checkpoint chain");
+                }
+            } catch (...) {
+                unmap();
+                throw;
+            }
+        }
+
+        ~CheckpointView() {
+            unmap();
+        }
+
+        CheckpointView(const CheckpointView &) = delete;
+        CheckpointView & operator=(const CheckpointView &) = delete;
+
+        size_t size() const {
+            return segments_.back().size;
+        }
+
+        std::optional<Value> find(const K & key) const {
+            const char *r = record(segments_.back().root_id);
+            size_t hashcode = Hasher()(key, 0);
+            size_t level = 0;
+            while (1) {
+                uint64_t bitmap = getU64(r + 1);
+                size_t bits = gitBits(hashcode, level);
+                if (!(bitmap & lshift(bits))) {
+                    return std::nullopt;
+                }
+                const char *kid = record(getU64(r + 9 + 8 * __builtin_popcountll(bitmap & (lshift(bits) - 1))));
+                if (kid[0] == INDEX_LEAF) {
+                    Value v = Codec().decode(kid + 9, getU64(kid + 1));
+                    if (Comp()(key, KeyExtractor()(v))) {
+                        return std::optional<Value>(std::move(v));
+                    } else {
+                        return std::nullopt;
+                    }
+                }
+                r = kid;
+                ++level;
+                if (level % PERIOD == 0) {
+                    hashcode = Hasher()(key, level / PERIOD);
+                }
+            }
+        }
+
+    private:
+        void unmap() {
+            for (const auto & s : segments_) {
+                ::munmap(const_cast<char *>(s.data), s.length);
+            }
+            segments_.clear();
+        }
+    };
+};
+
+template <typename K, typename V, typename Hasher = FastHasher<>, typename Comp = std::equal_to<K>,
+          size_t SmallSize = 0, typename Policy = AtomicRefCount<>>
+struct HAMTMap {
+    using Pair = std::pair<K, V>;
+    struct GetFirst {
+        const K & operator()(const Pair & p) {
+            return p.first;
+        }
+    };
+    using Impl = HAMT<Pair, GetFirst, Hasher, Comp, SmallSize, Policy>;
+    using Pointer = typename Impl::Pointer;
+    using ValuePtr = typename Impl::ValuePtr;
+
+    static ValuePtr find(const Pointer & p, const K & key) {
+        return Impl::find(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static ValuePtr find(const Pointer & p, const Q & key) {
+        return Impl::find(p, key);
+    }
+
+    static const Pair * find_ptr(const Pointer & p, const K & key) {
+        return Impl::find_ptr(p, key);
+    }
+
+    static ValuePtr find_copying(const Pointer & p, const K & key) {
+        return Impl::find_copying(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static const Pair * find_ptr(const Pointer & p, const Q & key) {
+        return Impl::find_ptr(p, key);
+    }
+
+    static bool contains(const Pointer & p, const K & key) {
+        return Impl::contains(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static bool contains(const Pointer & p, const Q & key) {
+        return Impl::contains(p, key);
+    }
+
+    static size_t size(const Pointer & p) {
+        return Impl::size(p);
+    }
+
+    static Pointer insert(const Pointer & p, const K & key, V && value) {
+        return Impl::insert(p, std::make_pair(key, std::move(value)));
+    }
+
+    static Pointer insert(const Pointer & p, const K & key, const V & value) {
+        return Impl::insert(p, std::make_pair(key, value));
+    }
+
+    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & p, const K & key, const V & value) {
+        return Impl::insert_return_value(p, std::make_pair(key, value));
+    }
+
+    static Pointer remove(const Pointer & p, const K & key) {
+        return Impl::remove(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static Pointer remove(const Pointer & p, const Q & key) {
+        return Impl::remove(p, key);
+    }
+
+    using Conflict = typename Impl::Conflict;
+    using Root = typename Impl::Root;
+
+    struct Transaction : public Impl::Transaction {
+        using Impl::Transaction::Transaction;
+        using Impl::Transaction::insert;
+
+        void insert(const K & key, V && value) {
+            Impl::Transaction::insert(std::make_pair(key, std::move(value)));
+        }
+
+        void insert(const K & key, const V & value) {
+            Impl::Transaction::insert(std::make_pair(key, value));
+        }
+    };
+
+    static Pointer merge3(const Pointer & base, const Pointer & ours, const Pointer & theirs,
+                          std::vector<Conflict> & conflicts) {
+        return Impl::merge3(base, ours, theirs, conflicts);
+    }
+    /*
+    static void toDot(Pointer root, std::ostream & os) {
+        Impl::toDot(root, os);
+    }*/
+    static Pointer create() {
+        return Impl::create();
+    }
+    
+    template <typename Callable>
+    static void for_each(const Pointer & hamt, const Callable & callback) {
+        Impl::for_each(hamt, callback);
+    }
+    template <typename Callable>
+    static void for_each_owned(const Pointer & hamt, const Callable & callback) {
+        Impl::for_each_owned(hamt, callback);
+    }
+    static void toDot(const Pointer & hamt, std::ostream & os) {
+        Impl::toDot(hamt, os);
+    }
+
+    using Stats = typename Impl::Stats;
+
+    static Stats stats(const Pointer & hamt) {
+        return Impl::stats(hamt);
+    }
+
+    template <typename Callable>
+    static Stats stats(const Pointer & hamt, const Callable & valueBytes) {
+        return Impl::stats(hamt, valueBytes);
+    }
+
+    static size_t shared_bytes(const Pointer & a, const Pointer & b) {
+        return Impl::shared_bytes(a, b);
+    }
+
+    template <typename Callable>
+    static size_t shared_bytes(const Pointer & a, const Pointer & b, const Callable & valueBytes) {
+        return Impl::shared_bytes(a, b, valueBytes);
+    }
+
+    template <typename Codec>
+    using CheckpointWriter = typename Impl::template CheckpointWriter<Codec>;
+    template <typename Codec>
+    using CheckpointLoader = typename Impl::template CheckpointLoader<Codec>;
+    template <typename Codec>
+    using CheckpointView = typename Impl::template CheckpointView<Codec>;
+};
+
+
+template <typename V, typename Hasher = FastHasher<>, typename Comp = std::equal_to<V>,
+          size_t SmallSize = 0, typename Policy = AtomicRefCount<>>
+struct HAMTSet {
+    struct Identity {
+        const V & operator()(const V & v) {
+            return v;
+        }
+    };
+    using Impl = HAMT<V, Identity, Hasher, Comp, SmallSize, Policy>;
+    using Pointer = typename Impl::Pointer;
+    using ValuePtr = typename Impl::ValuePtr;
+
+    static ValuePtr find(const Pointer & p, const V & key) {
+        return Impl::find(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static ValuePtr find(const Pointer & p, const Q & key) {
+        return Impl::find(p, key);
+    }
+
+    static const V * find_ptr(const Pointer & p, const V & key) {
+        return Impl::find_ptr(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static const V * find_ptr(const Pointer & p, const Q & key) {
+        return Impl::find_ptr(p, key);
+    }
+
+    static bool contains(const Pointer & p, const V & key) {
+        return Impl::contains(p, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static bool contains(const Pointer & p, const Q & key) {
+        return Impl::contains(p, key);
+    }
+
+    static Pointer insert(const Pointer & p, V && key) {
+        return Impl::insert(p, std::move(key));
+    }
+
+    static Pointer insert(const Pointer & p, const V & key) {
+        return Impl::insert(p, key);
+    }
+
+    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & root, const V & key) {
+        return Impl::insert_return_value(root, key);
+    }
+
+    static std::pair<Pointer, ValuePtr> insert_return_value(const Pointer & root, V && key) {
+        return Impl::insert_return_value(root, std::move(key));
+    }
+
+    static Pointer remove(const Pointer & root, const V & key) {
+        return Impl::remove(root, key);
+    }
+
+    template <typename Q, typename = typename Impl::template EnableLookup<Q>>
+    static Pointer remove(const Pointer & root, const Q & key) {
+        return Impl::remove(root, key);
+    }
+
+    using Conflict = typename Impl::Conflict;
+    using Root = typename Impl::Root;
+    using Transaction = typename Impl::Transaction;
+
+    static Pointer merge3(const Pointer & base, const Pointer & ours, const Pointer & theirs,
+                          std::vector<Conflict> & conflicts) {
+        return Impl::merge3(base, ours, theirs, conflicts);
+    }
+    static Pointer create() {
+        return Impl::create();
+    }
+
+    static size_t size(const Pointer & p) {
+        return Impl::size(p);
+    }
+
+    template <typename Callable>
+    static void for_each(const Pointer & hamt, const Callable & callback) {
+        Impl::for_each(hamt, callback);
+    }
+
+    template <typename Callable>
+    static void for_each_owned(const Pointer & hamt, const Callable & callback) {
+        Impl::for_each_owned(hamt, callback);
+    }
+
+    using Stats = typename Impl::Stats;
+
+    static Stats stats(const Pointer & hamt) {
+        return Impl::stats(hamt);
+    }
+
+    template <typename Callable>
+    static Stats stats(const Pointer & hamt, const Callable & valueBytes) {
+        return Impl::stats(hamt, valueBytes);
+    }
+
+    static size_t shared_bytes(const Pointer & a, const Pointer & b) {
+        return Impl::shared_bytes(a, b);
+    }
+
+    template <typename Callable>
+    static size_t shared_bytes(const Pointer & a, const Pointer & b, const Callable & valueBytes) {
+        return Impl::shared_bytes(a, b, valueBytes);
+    }
+
+    template <typename Codec>
+    using CheckpointWriter = typename Impl::template CheckpointWriter<Codec>;
+    template <typename Codec>
+    using CheckpointLoader = typename Impl::template CheckpointLoader<Codec>;
+    template <typename Codec>
+    using CheckpointView = typename Impl::template CheckpointView<Codec>;
+};
+
+/*
+ * Size-bounded cache on top of HAMTMap.
+ *
+ * Reads take no lock. Every reader thread keeps its own pinned copy of the
+ * current version and its own hit and miss counts, in a slot no other
+ * thread writes. A read compares the slot against the cache's generation
+ * counter, an atomic that only writers bump, and goes through Root (which
+ * locks, see there) only on the first read after a publication. A hit hands
+ * out a reference through the slot's own control block, so readers never
+ * share a reference count either. An idle reader keeps its last version
+ * alive until its next read.
+ *
+ * Writers are serialised, apply a whole Batch to a private version, evict
+ * down to budget, and publish with one root swap and a generation bump.
+ *
+ * Eviction is CLOCK. Every entry owns a slot in an array of reference bits
+ * that lives outside the immutable nodes. Readers set the bit on a hit;
+ * the writer's hand clears it, and evicts the first entry whose bit is
+ * already clear. Entries past their TTL are misses for readers and are
+ * dropped when the hand reaches them, or by expire().
+ */
+template <typename K, typename V, typename Hasher = FastHasher<>, typename Comp = std::equal_to<K>>
+class HAMTCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        V value;
+        Clock::time_point expires;
+        size_t bytes;
+        size_t slot;
+    };
+
+    using Map = HAMTMap<K, Entry, Hasher, Comp>;
+    using Pointer = typename Map::Pointer;
+    using ValuePtr = std::shared_ptr<const V>;
+
+    struct Options {
+        size_t max_entries;
+        size_t max_bytes = SIZE_MAX;
+        Clock::duration ttl = Clock::duration::max();
+    };
+
+    struct Counters {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t expirations;
+    };
+
+    class Batch {
+        friend class HAMTCache;
+        // no value means erase
+        std::vector< std::pair<K, std::optional<V>> > ops_;
+        std::vector<size_t> bytes_;
+    public:
+        void put(const K & key, V value, size_t bytes = sizeof(K) + sizeof(V)) {
+            ops_.emplace_back(key, std::move(value));
+            bytes_.push_back(bytes);
+        }
+
+        void erase(const K & key) {
+            ops_.emplace_back(key, std::nullopt);
+            bytes_.push_back(0);
+        }
+
+        size_t size() const {
+            return ops_.size();
+        }
+    };
+
+private:
+    // A reader thread's view of the cache, written only by that thread.
+    struct alignas(64) Reader {
+        std::thread::id thread;
+        uint64_t generation = 0;   // of pin; never a published generation
+        std::shared_ptr<const Pointer> pin;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    static void bump(std::atomic<uint64_t> & c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> id{1};
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const uint64_t id_ = nextId();
+    Options options_;
+    typename Map::Root root_;
+    std::atomic<uint64_t> generation_{1};
+    std::unique_ptr< std::atomic<uint8_t>[] > referenced_;
+
+    mutable std::mutex readersLock_;
+    std::vector< std::unique_ptr<Reader> > readers_;
+
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> expirations_{0};
+
+    // writer state, guarded by write_
+    std::mutex write_;
+    std::vector< std::optional<K> > slotKeys_;
+    std::vector<size_t> freeSlots_;
+    size_t hand_ = 0;
+    std::atomic<size_t> bytes_{0};
+
+    void drop(Pointer & p, const typename Map::ValuePtr & e) {
+        bytes_ -= e->second.bytes;
+        freeSlots_.push_back(e->second.slot);
+        slotKeys_[e->second.slot].reset();
+        p = Map::remove(p, e->first);
+    }
+
+    // advances the hand to the next victim and drops it
+    void evictOne(Pointer & p, Clock::time_point now) {
+        while (1) {
+            size_t slot = hand_;
+            hand_ = (hand_ + 1) % slotKeys_.size();
+            if (!slotKeys_[slot]) {
+                continue;
+            }
+            auto e = Map::find(p, *slotKeys_[slot]);
+            if (e->second.expires <= now) {
+                drop(p, e);
+                ++expirations_;
+                return;
+            }
+            if (referenced_[slot].exchange(0, std::memory_order_relaxed) == 0) {
+                drop(p, e);
+                ++evictions_;
+                return;
+            }
+        }
+    }
+
+public:
+    explicit HAMTCache(const Options & options)
+        : options_(options), root_(Map::create()),
+          referenced_(new std::atomic<uint8_t>[options.max_entries]),
+          slotKeys_(options.max_entries) {
+        assert(options.max_entries > 0);
+        for (size_t i = options.max_entries; i > 0; --i) {
+            referenced_[i - 1].store(0, std::memory_order_relaxed);
+            freeSlots_.push_back(i - 1);
+        }
+    }
+
+    HAMTCache(const HAMTCache &) = delete;
+    HAMTCache & operator=(const HAMTCache &) = delete;
+
+private:
+    // The calling thread's slot. A few recently used caches are remembered
+    // per thread by id, which is never reused; otherwise the thread looks
+    // its slot up, or adds one, under readersLock_.
+    Reader & reader() {
+        struct Ref {
+            uint64_t cache = 0;
+            Reader *reader = nullptr;
+        };
+        static thread_local Ref refs[8];
+        auto & ref = refs[id_ % 8];
+        if (ref.cache != id_) {
+            auto self = std::this_thread::get_id();
+            std::lock_guard<std::mutex> lock(readersLock_);
+            Reader *r = nullptr;
+            for (const auto & candidate : readers_) {
+                if (candidate->thread == self) {
+                    r = candidate.get();
+                    break;
+                }
+            }
+            if (!r) {
+                readers_.push_back(std::make_unique<Reader>());
+                r = readers_.back().get();
+                r->thread = self;
+            }
+            ref = Ref{id_, r};
+        }
+        return *ref.reader;
+    }
+
+    void publish(const Pointer & p) {
+        root_.store(p);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+public:
+    // The returned value stays valid for as long as the caller holds it,
+    // whatever writers do meanwhile.
+    ValuePtr get(const K & key) {
+        Reader & r = reader();
+        uint64_t generation = generation_.load(std::memory_order_acquire);
+        if (r.generation != generation) {
+            r.pin = std::make_shared<const Pointer>(root_.load());
+            r.generation = generation;
+        }
+        auto e = Map::find_ptr(*r.pin, key);
+        if (!e || e->second.expires <= Clock::now()) {
+            bump(r.misses);
+            return nullptr;
+        }
+        // test first so that hot entries do not keep dirtying the line
+        auto & bit = referenced_[e->second.slot];
+        if (!bit.load(std::memory_order_relaxed)) {
+            bit.store(1, std::memory_order_relaxed);
+        }
+        bump(r.hits);
+        return ValuePtr(r.pin, &e->second.value);
+    }
+
+    // Read-through: on a miss `load(key)` is called without any lock held
+    // and its result is cached. Concurrent misses on one key may each load.
+    template <typename Loader>
+    ValuePtr get(const K & key, const Loader & load, size_t bytes = sizeof(K) + sizeof(V)) {
+        auto v = get(key);
+        if (v) {
+            return v;
+        }
+        auto fresh = std::make_shared<const V>(load(key));
+        put(key, *fresh, bytes);
+        return fresh;
+    }
+
+    void put(const K & key, V value, size_t bytes = sizeof(K) + sizeof(V)) {
+        Batch b;
+        b.put(key, std::move(value), bytes);
+        apply(std::move(b));
+    }
+
+    void erase(const K & key) {
+        Batch b;
+        b.erase(key);
+        apply(std::move(b));
+    }
+
+    void apply(Batch && batch) {
+        std::lock_guard<std::mutex> lock(write_);
+        auto p = root_.load();
+        auto now = Clock::now();
+        auto expires = options_.ttl == Clock::duration::max() || now > Clock::time_point::max() - options_.ttl
+            ? Clock::time_point::max() : now + options_.ttl;
+        for (size_t i = 0; i < batch.ops_.size(); ++i) {
+            auto & op = batch.ops_[i];
+            auto old = Map::find(p, op.first);
+            if (!op.second) {
+                if (old) {
+                    drop(p, old);
+                }
+                continue;
+            }
+            size_t slot;
+            if (old) {
+                slot = old->second.slot;
+                bytes_ -= old->second.bytes;
+            } else {
+                if (freeSlots_.empty()) {
+                    evictOne(p, now);
+                }
+                slot = freeSlots_.back();
+                freeSlots_.pop_back();
+                slotKeys_[slot] = op.first;
+            }
+            referenced_[slot].store(1, std::memory_order_relaxed);
+            bytes_ += batch.bytes_[i];
+            p = Map::insert(p, op.first, Entry{std::move(*op.second), expires, batch.bytes_[i], slot});
+        }
+        while (bytes_ > options_.max_bytes && Map::size(p) > 0) {
+            evictOne(p, now);
+        }
+        publish(p);
+    }
+
+    // Drops every expired entry now instead of waiting for the hand.
+    void expire() {
+        std::lock_guard<std::mutex> lock(write_);
+        auto p = root_.load();
+        auto now = Clock::now();
+        std::vector<typename Map::ValuePtr> expired;
+        for (const auto & key : slotKeys_) {
+            if (key) {
+                auto e = Map::find(p, *key);
+                if (e->second.expires <= now) {
+                    expired.push_back(e);
+                }
+            }
+        }
+        for (const auto & e : expired) {
+            drop(p, e);
+            ++expirations_;
+        }
+        publish(p);
+    }
+
+    Pointer snapshot() const {
+        return root_.load();
+    }
+
+    size_t size() const {
+        return Map::size(root_.load());
+    }
+
+    size_t bytes() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+    // Sums every reader's counts; a read racing with this may be missed.
+    Counters counters() const {
+        Counters c{0, 0, evictions_.load(std::memory_order_relaxed),
+                   expirations_.load(std::memory_order_relaxed)};
+        std::lock_guard<std::mutex> lock(readersLock_);
+        for (const auto & r : readers_) {
+            c.hits += r->hits.load(std::memory_order_relaxed);
+            c.misses += r->misses.load(std::memory_order_relaxed);
+        }
+        return c;
+    }
+};
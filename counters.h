@@ -0,0 +1,261 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+ * Hot-path counters for the persistent structures.
+ *
+ * Off unless the translation unit is built with -DPERSIST_COUNTERS=1 (event
+ * totals and operation counts) or -DPERSIST_COUNTERS=2 (also a log2
+ * histogram of every event per operation). When off, count(), descend() and
+ * Scope are empty inline functions and compile to nothing.
+ *
+ * Each thread writes only its own block, so an update is a relaxed load and
+ * store with no lock prefix. snapshot() sums every live thread's block plus
+ * whatever exited threads left behind; reset() zeroes them. Both may miss an
+ * update that races with them, which is fine for exported metrics.
+ *
+ * Events:
+ *   PATH_COPY  a node copied because one of its children changed
+ *   PTR_COPY   child pointers copied into those new nodes (refcount bumps)
+ *   REHASH     Hasher(key, n) evaluated again below the root
+ *   ALLOC      nodes, leaves and version roots allocated
+ *   LEVEL      levels descended; LEVEL / ops is the mean depth
+ */
+#ifndef PERSIST_COUNTERS
+#define PERSIST_COUNTERS 0
+#endif
+
+namespace counters {
+
+enum Event : size_t { PATH_COPY, PTR_COPY, REHASH, ALLOC, LEVEL, EVENTS };
+enum Op : size_t { INSERT, REMOVE, MERGE, OPS };
+
+static constexpr bool ENABLED = PERSIST_COUNTERS >= 1;
+static constexpr bool HISTOGRAMS = PERSIST_COUNTERS >= 2;
+static constexpr size_t BUCKETS = 32;   // bucket b holds values in [2^(b-1), 2^b)
+
+struct Snapshot {
+    uint64_t events[EVENTS] = {};
+    uint64_t ops[OPS] = {};
+    uint64_t histogram[OPS][EVENTS][BUCKETS] = {};
+
+    Snapshot & operator+=(const Snapshot & o) {
+        for (size_t e = 0; e < EVENTS; ++e) {
+            events[e] += o.events[e];
+        }
+        for (size_t op = 0; op < OPS; ++op) {
+            ops[op] += o.ops[op];
+            for (size_t e = 0; e < EVENTS; ++e) {
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    histogram[op][e][b] += o.histogram[op][e][b];
+                }
+            }
+        }
+        return *this;
+    }
+};
+
+static inline size_t bucket(uint64_t v) {
+    size_t b = v ? 64 - __builtin_clzll(v) : 0;
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+namespace detail {
+
+using Counter = std::atomic<uint64_t>;
+
+static inline void bump(Counter & c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// The per-operation table exists only with histograms on. The disabled
+// form keeps a single counter so the accesses guarded by
+// `if constexpr (HISTOGRAMS)` still name a valid array.
+template <bool On>
+struct Histogram {
+    Counter counts[OPS][EVENTS][BUCKETS] = {};
+};
+
+template <>
+struct Histogram<false> {
+    Counter counts[1][1][1] = {};
+};
+
+struct Block {
+    Counter events[EVENTS] = {};
+    Counter ops[OPS] = {};
+    Histogram<HISTOGRAMS> histogram;
+
+    // state of the operation in progress; only the owning thread reads these
+    size_t nesting = 0;
+    uint64_t start[EVENTS] = {};
+
+    void addTo(Snapshot & s) const {
+        for (size_t e = 0; e < EVENTS; ++e) {
+            s.events[e] += events[e].load(std::memory_order_relaxed);
+        }
+        for (size_t op = 0; op < OPS; ++op) {
+            s.ops[op] += ops[op].load(std::memory_order_relaxed);
+        }
+        if constexpr (HISTOGRAMS) {
+            for (size_t op = 0; op < OPS; ++op) {
+                for (size_t e = 0; e < EVENTS; ++e) {
+                    for (size_t b = 0; b < BUCKETS; ++b) {
+                        s.histogram[op][e][b] += histogram.counts[op][e][b].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+    }
+
+    void clear() {
+        for (auto & c : events) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        for (auto & c : ops) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        if constexpr (HISTOGRAMS) {
+            for (auto & per_op : histogram.counts) {
+                for (auto & per_event : per_op) {
+                    for (auto & c : per_event) {
+                        c.store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+    }
+};
+
+struct Registry {
+    std::mutex lock;
+    std::vector<Block *> live;
+    Snapshot retired;
+};
+
+inline Registry & registry() {
+    static Registry * r = new Registry();   // outlives thread_local destructors
+    return *r;
+}
+
+struct Local : Block {
+    Local() {
+        auto & r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.live.push_back(this);
+    }
+
+    ~Local() {
+        auto & r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        addTo(r.retired);
+        for (auto & p : r.live) {
+            if (p == this) {
+                p = r.live.back();
+                r.live.pop_back();
+                break;
+            }
+        }
+    }
+};
+
+inline Block & local() {
+    static thread_local Local block;
+    return block;
+}
+
+} // namespace detail
+
+static inline void count(Event e, uint64_t n = 1) {
+    if constexpr (ENABLED) {
+        detail::bump(detail::local().events[e], n);
+    }
+}
+
+static inline void descend() {
+    count(LEVEL);
+}
+
+// A node rebuilt around one changed child, carrying `ptrs` existing pointers.
+static inline void path_copy(size_t ptrs) {
+    count(PATH_COPY);
+    count(PTR_COPY, ptrs);
+    count(ALLOC);
+}
+
+// Marks one public operation. Nested scopes (a wrapper calling the
+// implementation, a recursive insert) fold into the outermost one.
+class Scope {
+    [[maybe_unused]] Op op_;
+public:
+    explicit Scope(Op op) : op_(op) {
+        if constexpr (ENABLED) {
+            auto & b = detail::local();
+            if (b.nesting++ == 0 && HISTOGRAMS) {
+                for (size_t e = 0; e < EVENTS; ++e) {
+                    b.start[e] = b.events[e].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    ~Scope() {
+        if constexpr (ENABLED) {
+            auto & b = detail::local();
+            if (--b.nesting == 0) {
+                detail::bump(b.ops[op_]);
+                if constexpr (HISTOGRAMS) {
+                    for (size_t e = 0; e < EVENTS; ++e) {
+                        uint64_t now = b.events[e].load(std::memory_order_relaxed);
+                        uint64_t delta = now >= b.start[e] ? now - b.start[e] : 0;   // reset() mid-operation
+                        detail::bump(b.histogram.counts[op_][e][bucket(delta)]);
+                    }
+                }
+            }
+        }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope & operator=(const Scope &) = delete;
+};
+
+// Totals over every thread that has touched a counter, live or exited.
+static inline Snapshot snapshot() {
+    Snapshot s;
+    if constexpr (ENABLED) {
+        auto & r = detail::registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        s = r.retired;
+        for (auto * b : r.live) {
+            b->addTo(s);
+        }
+    }
+    return s;
+}
+
+// The calling thread's counters only; no lock.
+static inline Snapshot thread_snapshot() {
+    Snapshot s;
+    if constexpr (ENABLED) {
+        detail::local().addTo(s);
+    }
+    return s;
+}
+
+static inline void reset() {
+    if constexpr (ENABLED) {
+        auto & r = detail::registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.retired = Snapshot();
+        for (auto * b : r.live) {
+            b->clear();
+        }
+    }
+}
+
+} // namespace counters
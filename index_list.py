@@ -188,3 +188,10 @@ class IndexList:
 
     def __iter__(self):
         return TreeIter(self._root)
+
+# The native backend from persist.cc, when it has been built. Its nodes are
+# not AA-tree nodes, so it has no show().
+try:
+    from persist import IndexList
+except ImportError:
+    pass
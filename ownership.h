@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Ownership policies for the persistent structures.
+ *
+ * Ptr<T> owns a node or value, Weak<T> observes one, EnableShared<T> is the
+ * base that gives nodes shared_from_this(), make<T>(args...) allocates
+ * through Alloc, and Allocator<T> is Alloc<T> for the child arrays inside
+ * nodes.
+ *
+ * AtomicRefCount is plain std::shared_ptr and is the default.
+ * SingleThreadRefCount uses libstdc++'s single-threaded lock policy, so a
+ * path copy costs ordinary increments and decrements instead of atomic
+ * ones. With any other standard library it falls back to AtomicRefCount.
+ * A version built with it must never be reachable from two threads; that
+ * rules out HAMT::Root and everything built on it.
+ *
+ * Under either policy the find_ptr read path is the same: the caller's
+ * pointer to the version pins it, and the walk below uses raw pointers only,
+ * so a lookup touches no reference count. The result is borrowed and stays
+ * valid for as long as that pointer (or another owner of the version) is
+ * held.
+ */
+// What a reference-counted allocation costs on top of its object, as the
+// memory statistics count it. libstdc++'s control block is a vtable pointer
+// plus the use and weak counts under either policy.
+static constexpr size_t CONTROL_BLOCK_BYTES = sizeof(void *) + 2 * sizeof(int);
+
+template <template <typename> class Alloc = std::allocator>
+struct AtomicRefCount {
+    template <typename T>
+    using Ptr = std::shared_ptr<T>;
+    template <typename T>
+    using Weak = std::weak_ptr<T>;
+    template <typename T>
+    using EnableShared = std::enable_shared_from_this<T>;
+    template <typename T>
+    using Allocator = Alloc<T>;
+
+    template <typename T, typename... Args>
+    static Ptr<std::remove_const_t<T>> make(Args &&... args) {
+        using U = std::remove_const_t<T>;
+        return std::allocate_shared<U>(Alloc<U>(), std::forward<Args>(args)...);
+    }
+};
+
+#ifdef __GLIBCXX__
+template <template <typename> class Alloc = std::allocator>
+struct SingleThreadRefCount {
+    static const auto LOCK = __gnu_cxx::_S_single;
+
+    template <typename T>
+    using Ptr = std::__shared_ptr<T, LOCK>;
+    template <typename T>
+    using Weak = std::__weak_ptr<T, LOCK>;
+    template <typename T>
+    using EnableShared = std::__enable_shared_from_this<T, LOCK>;
+    template <typename T>
+    using Allocator = Alloc<T>;
+
+    template <typename T, typename... Args>
+    static Ptr<std::remove_const_t<T>> make(Args &&... args) {
+        using U = std::remove_const_t<T>;
+        return std::__allocate_shared<U, LOCK>(Alloc<U>(), std::forward<Args>(args)...);
+    }
+};
+#else
+template <template <typename> class Alloc = std::allocator>
+struct SingleThreadRefCount : AtomicRefCount<Alloc> {};
+#endif
@@ -0,0 +1,1613 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "bplus_tree.h"
+#include "chamt.h"
+#include "rrb_vector.h"
+#include "thread_safe_trie.h"
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * CPython bindings for the persistent structures, on the C API only, so a
+ * build needs nothing but the interpreter's headers:
+ *
+ *   g++ -std=c++17 -O2 -shared -fPIC $(python3-config --includes) \
+ *       -o persist$(python3-config --extension-suffix) persist.cc
+ *
+ * HAMTMap, HAMTSet and Trie are handles on a persistent version. Changing
+ * one swaps in a new version, and snapshot() returns a second handle on the
+ * current one in O(1). AATree and IndexList are native backends for
+ * aa_tree.py and index_list.py, on BPlusTree and RRBVector.
+ *
+ * A HAMT cannot separate two keys whose hashes agree in every generation,
+ * and Python hashes collide by design (hash(-1) == hash(-2)). The HAMTs are
+ * therefore keyed by the cached Python hash, and each leaf holds the bucket
+ * of keys that share it, compared with __eq__.
+ *
+ * Copying or dropping a PyRef needs the GIL, and so does __eq__. find_many
+ * looks keys up without it. The version is pinned by a C++ reference, and
+ * find_ptr touches no reference count. Exact str, bytes and int keys
+ * compare by value. Only a bucket hit on some other key type waits for the
+ * GIL to settle it with __eq__. Updates copy Python references, so they
+ * hold the GIL throughout.
+ */
+
+namespace {
+
+// A Python exception is already set.
+struct PyError {};
+
+// An owned reference.
+class PyRef {
+    PyObject *p_ = nullptr;
+
+    explicit PyRef(PyObject *p) : p_(p) {}
+public:
+    PyRef() = default;
+
+    static PyRef steal(PyObject *p) {
+        return PyRef(p);
+    }
+
+    static PyRef borrow(PyObject *p) {
+        Py_XINCREF(p);
+        return PyRef(p);
+    }
+
+    // a new reference, or PyError if p is null
+    static PyRef check(PyObject *p) {
+        if (!p) {
+            throw PyError();
+        }
+        return PyRef(p);
+    }
+
+    PyRef(const PyRef & o) : p_(o.p_) {
+        Py_XINCREF(p_);
+    }
+
+    PyRef(PyRef && o) noexcept : p_(o.p_) {
+        o.p_ = nullptr;
+    }
+
+    PyRef & operator=(PyRef o) noexcept {
+        std::swap(p_, o.p_);
+        return *this;
+    }
+
+    ~PyRef() {
+        Py_XDECREF(p_);
+    }
+
+    PyObject * get() const {
+        return p_;
+    }
+
+    PyObject * release() {
+        return std::exchange(p_, nullptr);
+    }
+
+    explicit operator bool() const {
+        return p_ != nullptr;
+    }
+
+    // identity; trie::setData uses it to skip a rewrite
+    bool operator==(const PyRef & o) const {
+        return p_ == o.p_;
+    }
+};
+
+static PyObject * newRef(PyObject *p) {
+    Py_INCREF(p);
+    return p;
+}
+
+// Runs f and turns a C++ exception into a Python one and `failed`.
+template <typename F, typename R = std::invoke_result_t<F>>
+static R guard(F && f, R failed = R()) {
+    try {
+        return f();
+    } catch (const PyError &) {
+    } catch (const std::bad_alloc &) {
+        PyErr_NoMemory();
+    } catch (const std::out_of_range & e) {
+        PyErr_SetString(PyExc_IndexError, e.what());
+    } catch (const std::invalid_argument & e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::exception & e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return failed;
+}
+
+// Raises KeyError(key), wrapped so that a tuple key is not taken as args.
+[[noreturn]] static void keyError(PyObject *key) {
+    PyObject *args = PyTuple_Pack(1, key);
+    if (args) {
+        PyErr_SetObject(PyExc_KeyError, args);
+        Py_DECREF(args);
+    }
+    throw PyError();
+}
+
+[[noreturn]] static void typeError(const char *message) {
+    PyErr_SetString(PyExc_TypeError, message);
+    throw PyError();
+}
+
+static size_t toIndex(PyObject *o) {
+    Py_ssize_t i = PyLong_AsSsize_t(o);
+    if (i == -1 && PyErr_Occurred()) {
+        throw PyError();
+    }
+    if (i < 0) {
+        throw std::out_of_range("index out of bound");
+    }
+    return i;
+}
+
+/*
+ * The part of a key that compares without the GIL: an exact str, bytes or
+ * an int that fits in 64 bits. data borrows from the object, which the key
+ * holding it keeps alive, and a str or bytes never changes in place.
+ */
+struct NativeKey {
+    enum Kind : uint8_t { NONE, STR, BYTES, INT };
+    Kind kind = NONE;
+    uint8_t width = 0;          // bytes per code point of a str
+    Py_ssize_t len = 0;
+    const void *data = nullptr;
+    long long value = 0;
+
+    static NativeKey of(PyObject *o) {
+        NativeKey n;
+        if (PyUnicode_CheckExact(o)) {
+#if PY_VERSION_HEX < 0x030C0000
+            if (PyUnicode_READY(o) < 0) {
+                throw PyError();
+            }
+#endif
+            n.kind = STR;
+            n.width = PyUnicode_KIND(o);
+            n.len = PyUnicode_GET_LENGTH(o);
+            n.data = PyUnicode_DATA(o);
+        } else if (PyBytes_CheckExact(o)) {
+            n.kind = BYTES;
+            n.width = 1;
+            n.len = PyBytes_GET_SIZE(o);
+            n.data = PyBytes_AS_STRING(o);
+        } else if (PyLong_CheckExact(o)) {
+            int overflow = 0;
+            long long v = PyLong_AsLongLongAndOverflow(o, &overflow);
+            if (!overflow) {
+                n.kind = INT;
+                n.value = v;
+            }
+        }
+        return n;
+    }
+
+    // 1 or 0 when both sides decide it by value, -1 when __eq__ has to
+    int equals(const NativeKey & o) const {
+        if (kind == NONE || o.kind == NONE) {
+            return -1;
+        }
+        if (kind != o.kind) {
+            return 0;
+        }
+        if (kind == INT) {
+            return value == o.value;
+        }
+        return len == o.len && width == o.width && std::memcmp(data, o.data, len * width) == 0;
+    }
+};
+
+struct Key {
+    PyRef obj;
+    Py_hash_t hash = 0;
+    NativeKey native;
+
+    static Key of(PyObject *o) {
+        Py_hash_t hash = PyObject_Hash(o);
+        if (hash == -1) {
+            throw PyError();
+        }
+        return Key{PyRef::borrow(o), hash, NativeKey::of(o)};
+    }
+};
+
+// identity, then by value, then __eq__ with the stored key on the left, as dict does
+static bool equal(const Key & stored, PyObject *obj, const NativeKey & native) {
+    if (stored.obj.get() == obj) {
+        return true;
+    }
+    int r = stored.native.equals(native);
+    if (r < 0 && (r = PyObject_RichCompareBool(stored.obj.get(), obj, Py_EQ)) < 0) {
+        throw PyError();
+    }
+    return r;
+}
+
+struct MapEntry {
+    Key key;
+    PyRef value;
+};
+
+static const Key & keyOf(const MapEntry & e) {
+    return e.key;
+}
+
+static const Key & keyOf(const Key & k) {
+    return k;
+}
+
+// position of the key in a bucket, or -1
+template <typename Entry>
+static ptrdiff_t locate(const std::vector<Entry> & bucket, PyObject *obj, const NativeKey & native) {
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        if (equal(keyOf(bucket[i]), obj, native)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// As locate, without the GIL; -2 when an earlier candidate needs __eq__.
+template <typename Entry>
+static ptrdiff_t locateNative(const std::vector<Entry> & bucket, PyObject *obj, const NativeKey & native) {
+    bool undecided = false;
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        const Key & k = keyOf(bucket[i]);
+        int r = k.obj.get() == obj ? 1 : k.native.equals(native);
+        if (r > 0) {
+            return undecided ? -2 : i;
+        }
+        undecided |= r < 0;
+    }
+    return undecided ? -2 : -1;
+}
+
+/*
+ * The HAMT behind each Python type: how to reach the bucket for a hash, how
+ * to store one back, and what a hit yields.
+ */
+struct MapTraits {
+    using Entry = MapEntry;
+    using Bucket = std::vector<MapEntry>;
+    using Impl = HAMTMap<Py_hash_t, Bucket>;
+    using Pointer = Impl::Pointer;
+
+    static const Bucket * find(const Pointer & root, Py_hash_t hash) {
+        auto p = Impl::find_ptr(root, hash);
+        return p ? &p->second : nullptr;
+    }
+
+    static Pointer store(const Pointer & root, Py_hash_t hash, Bucket && bucket) {
+        return Impl::insert(root, hash, std::move(bucket));
+    }
+
+    // false when nothing changed
+    static bool replace(Entry & old, Entry && entry) {
+        old.value = std::move(entry.value);
+        return true;
+    }
+
+    static PyObject * result(const Entry & e) {
+        return e.value.get();
+    }
+};
+
+struct SetBucket {
+    Py_hash_t hash;
+    std::vector<Key> keys;
+};
+
+// Buckets hash and compare by their Python hash, and are found by it.
+struct BucketHasher {
+    using is_transparent = void;
+
+    size_t operator()(Py_hash_t hash, size_t n) const {
+        return FastHasher<>()(hash, n);
+    }
+
+    size_t operator()(const SetBucket & b, size_t n) const {
+        return (*this)(b.hash, n);
+    }
+};
+
+struct BucketEqual {
+    using is_transparent = void;
+
+    bool operator()(Py_hash_t hash, const SetBucket & b) const {
+        return hash == b.hash;
+    }
+
+    bool operator()(const SetBucket & a, const SetBucket & b) const {
+        return a.hash == b.hash;
+    }
+};
+
+struct SetTraits {
+    using Entry = Key;
+    using Bucket = std::vector<Key>;
+    using Impl = HAMTSet<SetBucket, BucketHasher, BucketEqual>;
+    using Pointer = Impl::Pointer;
+
+    static const Bucket * find(const Pointer & root, Py_hash_t hash) {
+        auto p = Impl::find_ptr(root, hash);
+        return p ? &p->keys : nullptr;
+    }
+
+    static Pointer store(const Pointer & root, Py_hash_t hash, Bucket && bucket) {
+        return Impl::insert(root, SetBucket{hash, std::move(bucket)});
+    }
+
+    static bool replace(Entry &, Entry &&) {
+        return false;
+    }
+
+    static PyObject * result(const Entry & e) {
+        return e.obj.get();
+    }
+};
+
+template <typename Traits>
+struct HashState {
+    typename Traits::Pointer root = Traits::Impl::create();
+    size_t size = 0;
+};
+
+struct TrieEntry {
+    PyRef key;
+    PyRef value;
+
+    bool operator==(const TrieEntry & o) const {
+        return key == o.key && value == o.value;
+    }
+};
+
+using TrieImpl = trie<TrieEntry>;
+
+struct TrieState {
+    TrieImpl::NodePtr root;
+    size_t size = 0;
+};
+
+using ListImpl = RRBVector<PyRef>;
+
+struct ListState {
+    ListImpl::Pointer root = ListImpl::create();
+};
+
+struct PyLess {
+    bool operator()(const PyRef & a, const PyRef & b) const {
+        int r = PyObject_RichCompareBool(a.get(), b.get(), Py_LT);
+        if (r < 0) {
+            throw PyError();
+        }
+        return r;
+    }
+};
+
+using TreeImpl = BPlusTree<PyRef, PyRef, PyLess>;
+
+struct TreeState {
+    TreeImpl tree;
+    bool busy = false;
+};
+
+enum IterMode { KEYS, VALUES, ITEMS };
+
+// The entries of a pinned version, borrowed from it.
+struct IterState {
+    std::shared_ptr<const void> pin;
+    std::vector<std::pair<PyObject *, PyObject *>> items;
+    size_t pos = 0;
+    IterMode mode = KEYS;
+};
+
+template <typename State>
+struct Object {
+    PyObject_HEAD
+    State state;
+};
+
+template <typename State>
+static State & state(PyObject *self) {
+    return reinterpret_cast<Object<State> *>(self)->state;
+}
+
+template <typename State>
+static PyObject * newObject(PyTypeObject *type, PyObject *, PyObject *) {
+    PyObject *self = type->tp_alloc(type, 0);
+    if (!self) {
+        return nullptr;
+    }
+    try {
+        new (&state<State>(self)) State();
+    } catch (const std::bad_alloc &) {
+        type->tp_free(self);
+        Py_DECREF(type);
+        return PyErr_NoMemory();
+    }
+    return self;
+}
+
+template <typename State>
+static void deallocObject(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    if (PyType_IS_GC(type)) {
+        PyObject_GC_UnTrack(self);
+    }
+    state<State>(self).~State();
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+// another handle on the same version
+template <typename State>
+static PyObject * snapshot(PyObject *self, PyObject *) {
+    PyObject *copy = newObject<State>(Py_TYPE(self), nullptr, nullptr);
+    if (copy) {
+        state<State>(copy) = state<State>(self);
+    }
+    return copy;
+}
+
+/*
+ * Cycle collection. Handles share versions and subtrees, and the collector
+ * must not see one reference through two of them, so a handle reports only
+ * what it reaches alone (for_each_owned). A cycle through a version that is
+ * still shared is collected once the sharing ends. AATree owns its tree
+ * outright, and reports the separator copies of keys in its inner nodes
+ * along with the entries.
+ */
+template <typename F>
+static void reachable(const HashState<MapTraits> & s, const F & f) {
+    MapTraits::Impl::for_each_owned(s.root, [&](const MapTraits::Impl::Pair & p) {
+        for (const auto & e : p.second) {
+            f(e.key.obj);
+            f(e.value);
+        }
+    });
+}
+
+template <typename F>
+static void reachable(const HashState<SetTraits> & s, const F & f) {
+    SetTraits::Impl::for_each_owned(s.root, [&](const SetBucket & b) {
+        for (const auto & k : b.keys) {
+            f(k.obj);
+        }
+    });
+}
+
+template <typename F>
+static void reachable(const TrieState & s, const F & f) {
+    TrieImpl::for_each_owned(s.root, [&](const TrieEntry & e) {
+        f(e.key);
+        f(e.value);
+    });
+}
+
+template <typename F>
+static void reachable(const ListState & s, const F & f) {
+    ListImpl::for_each_owned(s.root, f);
+}
+
+// mid-operation the tree may be half rebuilt; report nothing until it is done
+template <typename F>
+static void reachable(const TreeState & s, const F & f) {
+    if (s.busy) {
+        return;
+    }
+    for (auto it = s.tree.begin(); it != s.tree.end(); ++it) {
+        f(it.key());
+        f(it.value());
+    }
+    s.tree.for_each_separator(f);
+}
+
+template <typename State>
+static int traverseObject(PyObject *self, visitproc visit, void *arg) {
+    Py_VISIT(Py_TYPE(self));
+    int r = 0;
+    reachable(state<State>(self), [&](const PyRef & ref) {
+        if (r == 0 && ref) {
+            r = visit(ref.get(), arg);
+        }
+    });
+    return r;
+}
+
+// Swaps in an empty state, then drops the old one: whatever the released
+// objects run on the way out finds a usable handle.
+template <typename State>
+static int clearObject(PyObject *self) {
+    if constexpr (std::is_same_v<State, TreeState>) {
+        if (state<State>(self).busy) {
+            return 0;
+        }
+    }
+    try {
+        State old = std::exchange(state<State>(self), State());
+    } catch (const std::bad_alloc &) {
+        // left for the next collection
+    }
+    return 0;
+}
+
+static PyTypeObject *IterType = nullptr;
+
+static PyObject * makeIter(std::shared_ptr<const void> pin,
+                           std::vector<std::pair<PyObject *, PyObject *>> && items, IterMode mode) {
+    PyObject *it = newObject<IterState>(IterType, nullptr, nullptr);
+    if (it) {
+        auto & s = state<IterState>(it);
+        s.pin = std::move(pin);
+        s.items = std::move(items);
+        s.mode = mode;
+    }
+    return it;
+}
+
+static PyObject * iterNext(PyObject *self) {
+    auto & s = state<IterState>(self);
+    if (s.pos == s.items.size()) {
+        s.items.clear();
+        s.pin.reset();
+        return nullptr;
+    }
+    auto [k, v] = s.items[s.pos++];
+    switch (s.mode) {
+        case KEYS:
+            return newRef(k);
+        case VALUES:
+            return newRef(v);
+        default:
+            return PyTuple_Pack(2, k, v);
+    }
+}
+
+static PyObject * iterLengthHint(PyObject *self, PyObject *) {
+    auto & s = state<IterState>(self);
+    return PyLong_FromSize_t(s.items.size() - s.pos);
+}
+
+static PyMethodDef iterMethods[] = {
+    {"__length_hint__", iterLengthHint, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot iterSlots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<IterState>)},
+    {Py_tp_iter, reinterpret_cast<void *>(PyObject_SelfIter)},
+    {Py_tp_iternext, reinterpret_cast<void *>(iterNext)},
+    {Py_tp_methods, iterMethods},
+    {0, nullptr},
+};
+
+static PyType_Spec iterSpec = {
+    "persist.Iterator", sizeof(Object<IterState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, iterSlots,
+};
+
+// Calls f(item) for each item of an iterable.
+template <typename F>
+static void forEachItem(PyObject *iterable, const F & f) {
+    PyRef it = PyRef::check(PyObject_GetIter(iterable));
+    while (PyRef item = PyRef::steal(PyIter_Next(it.get()))) {
+        f(item.get());
+    }
+    if (PyErr_Occurred()) {
+        throw PyError();
+    }
+}
+
+// Calls f(key, value) for a mapping's items or an iterable of pairs.
+template <typename F>
+static void forEachPair(PyObject *source, const F & f) {
+    if (PyDict_CheckExact(source)) {
+        // iterate a private copy: f may run __eq__, which may change the dict
+        PyRef items = PyRef::check(PyDict_Items(source));
+        forEachPair(items.get(), f);
+        return;
+    }
+    PyRef items;
+    if (PyObject_HasAttrString(source, "items")) {
+        items = PyRef::check(PyObject_CallMethod(source, "items", nullptr));
+        source = items.get();
+    }
+    forEachItem(source, [&](PyObject *item) {
+        PyRef pair = PyRef::check(PySequence_Fast(item, "expected (key, value) pairs"));
+        if (PySequence_Fast_GET_SIZE(pair.get()) != 2) {
+            typeError("expected (key, value) pairs");
+        }
+        PyObject **kv = PySequence_Fast_ITEMS(pair.get());
+        f(kv[0], kv[1]);
+    });
+}
+
+/*
+ * HAMTMap and HAMTSet
+ */
+
+// Stores entry into root; true when its key is new.
+template <typename Traits>
+static bool put(typename Traits::Pointer & root, typename Traits::Entry && entry) {
+    Py_hash_t hash = keyOf(entry).hash;
+    const auto *found = Traits::find(root, hash);
+    typename Traits::Bucket bucket;
+    ptrdiff_t pos = -1;
+    if (found) {
+        pos = locate(*found, keyOf(entry).obj.get(), keyOf(entry).native);
+        bucket = *found;
+    }
+    if (pos >= 0) {
+        if (Traits::replace(bucket[pos], std::move(entry))) {
+            root = Traits::store(root, hash, std::move(bucket));
+        }
+        return false;
+    }
+    bucket.push_back(std::move(entry));
+    root = Traits::store(root, hash, std::move(bucket));
+    return true;
+}
+
+// Removes key from root; false when it is absent.
+template <typename Traits>
+static bool erase(typename Traits::Pointer & root, const Key & key) {
+    const auto *found = Traits::find(root, key.hash);
+    ptrdiff_t pos = found ? locate(*found, key.obj.get(), key.native) : -1;
+    if (pos < 0) {
+        return false;
+    }
+    if (found->size() == 1) {
+        root = Traits::Impl::remove(root, key.hash);
+    } else {
+        auto bucket = *found;
+        bucket.erase(bucket.begin() + pos);
+        root = Traits::store(root, key.hash, std::move(bucket));
+    }
+    return true;
+}
+
+// the stored entry for obj, or null
+template <typename Traits>
+static const typename Traits::Entry * lookup(const typename Traits::Pointer & root, PyObject *obj) {
+    Key key = Key::of(obj);
+    const auto *found = Traits::find(root, key.hash);
+    ptrdiff_t pos = found ? locate(*found, obj, key.native) : -1;
+    return pos >= 0 ? &(*found)[pos] : nullptr;
+}
+
+template <typename Traits>
+static Py_ssize_t hashLength(PyObject *self) {
+    return state<HashState<Traits>>(self).size;
+}
+
+template <typename Traits>
+static int hashContains(PyObject *self, PyObject *key) {
+    return guard([&] {
+        auto root = state<HashState<Traits>>(self).root;
+        return lookup<Traits>(root, key) ? 1 : 0;
+    }, -1);
+}
+
+template <typename Traits>
+static PyObject * hashSnapshot(PyObject *self, PyObject *) {
+    return snapshot<HashState<Traits>>(self, nullptr);
+}
+
+template <typename Traits>
+static PyObject * hashIter(PyObject *self, IterMode mode) {
+    return guard([&] {
+        const auto & root = state<HashState<Traits>>(self).root;
+        std::vector<std::pair<PyObject *, PyObject *>> items;
+        items.reserve(state<HashState<Traits>>(self).size);
+        Traits::Impl::for_each(root, [&](const auto & leaf) {
+            const typename Traits::Bucket *bucket;
+            if constexpr (std::is_same_v<Traits, MapTraits>) {
+                bucket = &leaf.second;
+            } else {
+                bucket = &leaf.keys;
+            }
+            for (const auto & e : *bucket) {
+                items.emplace_back(keyOf(e).obj.get(), Traits::result(e));
+            }
+        });
+        return makeIter(root, std::move(items), mode);
+    });
+}
+
+/*
+ * Looks up every key of a sequence, returning the hits in order and
+ * `default` for misses. Hashes are taken first; the lookups then run
+ * without the GIL, and only the keys they leave undecided go to __eq__.
+ */
+template <typename Traits>
+static PyObject * hashFindMany(PyObject *self, PyObject *args) {
+    PyObject *keys;
+    PyObject *fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:find_many", &keys, &fallback)) {
+        return nullptr;
+    }
+    return guard([&] {
+        // A tuple of our own: a list's items could be replaced, and freed,
+        // by another thread while the GIL is released below.
+        PyRef seq = PyRef::check(PySequence_Tuple(keys));
+        Py_ssize_t n = PyTuple_GET_SIZE(seq.get());
+        PyObject **objs = PySequence_Fast_ITEMS(seq.get());
+
+        struct Probe {
+            Py_hash_t hash;
+            NativeKey native;
+            const typename Traits::Bucket *bucket;
+            ptrdiff_t pos;
+        };
+        std::vector<Probe> probes(n);
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            probes[i].hash = PyObject_Hash(objs[i]);
+            if (probes[i].hash == -1) {
+                throw PyError();
+            }
+            probes[i].native = NativeKey::of(objs[i]);
+        }
+
+        auto root = state<HashState<Traits>>(self).root;   // pinned while the GIL is released
+        Py_BEGIN_ALLOW_THREADS
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            auto & p = probes[i];
+            p.bucket = Traits::find(root, p.hash);
+            p.pos = p.bucket ? locateNative(*p.bucket, objs[i], p.native) : -1;
+        }
+        Py_END_ALLOW_THREADS
+
+        PyRef result = PyRef::check(PyList_New(n));
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            auto & p = probes[i];
+            if (p.pos == -2) {
+                p.pos = locate(*p.bucket, objs[i], p.native);
+            }
+            PyObject *v = p.pos >= 0 ? Traits::result((*p.bucket)[p.pos]) : fallback;
+            PyList_SET_ITEM(result.get(), i, newRef(v));
+        }
+        return result.release();
+    });
+}
+
+// HAMTMap
+
+using MapState = HashState<MapTraits>;
+
+static PyObject * mapSubscript(PyObject *self, PyObject *key) {
+    return guard([&] {
+        auto root = state<MapState>(self).root;
+        auto e = lookup<MapTraits>(root, key);
+        if (!e) {
+            keyError(key);
+        }
+        return newRef(e->value.get());
+    });
+}
+
+// put and erase may run __eq__, which may change this map meanwhile. The
+// size is read with the root and written back with it, so the two always
+// describe the same version; a change made by __eq__ is overwritten whole.
+static void mapSet(PyObject *self, PyObject *key, PyObject *value) {
+    auto & s = state<MapState>(self);
+    auto root = s.root;
+    size_t size = s.size;
+    size += put<MapTraits>(root, MapEntry{Key::of(key), PyRef::borrow(value)});
+    s.root = std::move(root);
+    s.size = size;
+}
+
+static void mapRemove(PyObject *self, PyObject *key) {
+    auto & s = state<MapState>(self);
+    auto root = s.root;
+    size_t size = s.size;
+    if (!erase<MapTraits>(root, Key::of(key))) {
+        keyError(key);
+    }
+    s.root = std::move(root);
+    s.size = size - 1;
+}
+
+static int mapAssSubscript(PyObject *self, PyObject *key, PyObject *value) {
+    return guard([&] {
+        if (value) {
+            mapSet(self, key, value);
+        } else {
+            mapRemove(self, key);
+        }
+        return 0;
+    }, -1);
+}
+
+static PyObject * mapGet(PyObject *self, PyObject *args) {
+    PyObject *key;
+    PyObject *fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:get", &key, &fallback)) {
+        return nullptr;
+    }
+    return guard([&] {
+        auto root = state<MapState>(self).root;
+        auto e = lookup<MapTraits>(root, key);
+        return newRef(e ? e->value.get() : fallback);
+    });
+}
+
+static PyObject * mapSetMethod(PyObject *self, PyObject *args) {
+    PyObject *key, *value;
+    if (!PyArg_ParseTuple(args, "OO:set", &key, &value)) {
+        return nullptr;
+    }
+    return guard([&] {
+        mapSet(self, key, value);
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * mapRemoveMethod(PyObject *self, PyObject *key) {
+    return guard([&] {
+        mapRemove(self, key);
+        Py_RETURN_NONE;
+    });
+}
+
+// All or nothing: on an error the map keeps its previous version.
+static PyObject * mapUpdate(PyObject *self, PyObject *source) {
+    return guard([&] {
+        auto & s = state<MapState>(self);
+        auto root = s.root;
+        size_t size = s.size;
+        forEachPair(source, [&](PyObject *key, PyObject *value) {
+            size += put<MapTraits>(root, MapEntry{Key::of(key), PyRef::borrow(value)});
+        });
+        s.root = std::move(root);
+        s.size = size;
+        Py_RETURN_NONE;
+    });
+}
+
+static int mapInit(PyObject *self, PyObject *args, PyObject *kwds) {
+    PyObject *source = nullptr;
+    static const char *names[] = {"source", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:HAMTMap", const_cast<char **>(names), &source)) {
+        return -1;
+    }
+    if (source) {
+        PyObject *r = mapUpdate(self, source);
+        Py_XDECREF(r);
+        return r ? 0 : -1;
+    }
+    return 0;
+}
+
+static PyObject * mapIter(PyObject *self) {
+    return hashIter<MapTraits>(self, KEYS);
+}
+
+static PyObject * mapValues(PyObject *self, PyObject *) {
+    return hashIter<MapTraits>(self, VALUES);
+}
+
+static PyObject * mapItems(PyObject *self, PyObject *) {
+    return hashIter<MapTraits>(self, ITEMS);
+}
+
+static PyMethodDef mapMethods[] = {
+    {"get", mapGet, METH_VARARGS, "get(key, default=None)"},
+    {"set", mapSetMethod, METH_VARARGS, "set(key, value)"},
+    {"remove", mapRemoveMethod, METH_O, "remove(key); KeyError if absent"},
+    {"update", mapUpdate, METH_O, "update(mapping or pairs); all or nothing"},
+    {"find_many", hashFindMany<MapTraits>, METH_VARARGS,
+     "find_many(keys, default=None) -> list of values, looked up without the GIL where possible"},
+    {"snapshot", hashSnapshot<MapTraits>, METH_NOARGS, "another map on the current version, in O(1)"},
+    {"values", mapValues, METH_NOARGS, nullptr},
+    {"items", mapItems, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot mapSlots[] = {
+    {Py_tp_doc, const_cast<char *>("Persistent hash map on a HAMT; snapshot() is O(1).")},
+    {Py_tp_new, reinterpret_cast<void *>(newObject<MapState>)},
+    {Py_tp_init, reinterpret_cast<void *>(mapInit)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<MapState>)},
+    {Py_tp_traverse, reinterpret_cast<void *>(traverseObject<MapState>)},
+    {Py_tp_clear, reinterpret_cast<void *>(clearObject<MapState>)},
+    {Py_tp_iter, reinterpret_cast<void *>(mapIter)},
+    {Py_tp_methods, mapMethods},
+    {Py_mp_length, reinterpret_cast<void *>(hashLength<MapTraits>)},
+    {Py_sq_length, reinterpret_cast<void *>(hashLength<MapTraits>)},
+    {Py_mp_subscript, reinterpret_cast<void *>(mapSubscript)},
+    {Py_mp_ass_subscript, reinterpret_cast<void *>(mapAssSubscript)},
+    {Py_sq_contains, reinterpret_cast<void *>(hashContains<MapTraits>)},
+    {0, nullptr},
+};
+
+static PyType_Spec mapSpec = {
+    "persist.HAMTMap", sizeof(Object<MapState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, mapSlots,
+};
+
+// HAMTSet
+
+using SetState = HashState<SetTraits>;
+
+static PyObject * setAdd(PyObject *self, PyObject *key) {
+    return guard([&] {
+        auto & s = state<SetState>(self);
+        auto root = s.root;
+        size_t size = s.size;   // with the root, as in mapSet
+        size += put<SetTraits>(root, Key::of(key));
+        s.root = std::move(root);
+        s.size = size;
+        Py_RETURN_NONE;
+    });
+}
+
+static bool setErase(PyObject *self, PyObject *key) {
+    auto & s = state<SetState>(self);
+    auto root = s.root;
+    size_t size = s.size;
+    if (!erase<SetTraits>(root, Key::of(key))) {
+        return false;
+    }
+    s.root = std::move(root);
+    s.size = size - 1;
+    return true;
+}
+
+static PyObject * setRemove(PyObject *self, PyObject *key) {
+    return guard([&] {
+        if (!setErase(self, key)) {
+            keyError(key);
+        }
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * setDiscard(PyObject *self, PyObject *key) {
+    return guard([&] {
+        setErase(self, key);
+        Py_RETURN_NONE;
+    });
+}
+
+// All or nothing: on an error the set keeps its previous version.
+static PyObject * setUpdate(PyObject *self, PyObject *source) {
+    return guard([&] {
+        auto & s = state<SetState>(self);
+        auto root = s.root;
+        size_t size = s.size;
+        forEachItem(source, [&](PyObject *key) {
+            size += put<SetTraits>(root, Key::of(key));
+        });
+        s.root = std::move(root);
+        s.size = size;
+        Py_RETURN_NONE;
+    });
+}
+
+static int setInit(PyObject *self, PyObject *args, PyObject *kwds) {
+    PyObject *source = nullptr;
+    static const char *names[] = {"source", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:HAMTSet", const_cast<char **>(names), &source)) {
+        return -1;
+    }
+    if (source) {
+        PyObject *r = setUpdate(self, source);
+        Py_XDECREF(r);
+        return r ? 0 : -1;
+    }
+    return 0;
+}
+
+static PyObject * setIter(PyObject *self) {
+    return hashIter<SetTraits>(self, KEYS);
+}
+
+static PyMethodDef setMethods[] = {
+    {"add", setAdd, METH_O, "add(key)"},
+    {"remove", setRemove, METH_O, "remove(key); KeyError if absent"},
+    {"discard", setDiscard, METH_O, "discard(key)"},
+    {"update", setUpdate, METH_O, "update(iterable); all or nothing"},
+    {"find_many", hashFindMany<SetTraits>, METH_VARARGS,
+     "find_many(keys, default=None) -> list of the stored keys, looked up without the GIL where possible"},
+    {"snapshot", hashSnapshot<SetTraits>, METH_NOARGS, "another set on the current version, in O(1)"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot setSlots[] = {
+    {Py_tp_doc, const_cast<char *>("Persistent hash set on a HAMT; snapshot() is O(1).")},
+    {Py_tp_new, reinterpret_cast<void *>(newObject<SetState>)},
+    {Py_tp_init, reinterpret_cast<void *>(setInit)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<SetState>)},
+    {Py_tp_traverse, reinterpret_cast<void *>(traverseObject<SetState>)},
+    {Py_tp_clear, reinterpret_cast<void *>(clearObject<SetState>)},
+    {Py_tp_iter, reinterpret_cast<void *>(setIter)},
+    {Py_tp_methods, setMethods},
+    {Py_sq_length, reinterpret_cast<void *>(hashLength<SetTraits>)},
+    {Py_sq_contains, reinterpret_cast<void *>(hashContains<SetTraits>)},
+    {0, nullptr},
+};
+
+static PyType_Spec setSpec = {
+    "persist.HAMTSet", sizeof(Object<SetState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, setSlots,
+};
+
+/*
+ * Trie: str keys, stored by their UTF-8 bytes.
+ */
+
+static std::string_view utf8(PyObject *key) {
+    if (!PyUnicode_Check(key)) {
+        typeError("Trie keys must be str");
+    }
+    Py_ssize_t len;
+    const char *data = PyUnicode_AsUTF8AndSize(key, &len);   // cached in the str
+    if (!data) {
+        throw PyError();
+    }
+    return std::string_view(data, len);
+}
+
+static Py_ssize_t trieLength(PyObject *self) {
+    return state<TrieState>(self).size;
+}
+
+static int trieContains(PyObject *self, PyObject *key) {
+    return guard([&] {
+        return TrieImpl::contains(state<TrieState>(self).root, utf8(key)) ? 1 : 0;
+    }, -1);
+}
+
+static PyObject * trieSubscript(PyObject *self, PyObject *key) {
+    return guard([&] {
+        auto e = TrieImpl::find_ptr(state<TrieState>(self).root, utf8(key));
+        if (!e) {
+            keyError(key);
+        }
+        return newRef(e->value.get());
+    });
+}
+
+static void trieSet(PyObject *self, PyObject *key, PyObject *value) {
+    auto & s = state<TrieState>(self);
+    auto k = utf8(key);
+    auto old = TrieImpl::find_ptr(s.root, k);
+    s.root = TrieImpl::insert(s.root, k, TrieEntry{old ? old->key : PyRef::borrow(key), PyRef::borrow(value)});
+    s.size += !old;
+}
+
+static void trieRemove(PyObject *self, PyObject *key) {
+    auto & s = state<TrieState>(self);
+    auto k = utf8(key);
+    if (!TrieImpl::contains(s.root, k)) {
+        keyError(key);
+    }
+    s.root = TrieImpl::remove(s.root, k);
+    --s.size;
+}
+
+static int trieAssSubscript(PyObject *self, PyObject *key, PyObject *value) {
+    return guard([&] {
+        if (value) {
+            trieSet(self, key, value);
+        } else {
+            trieRemove(self, key);
+        }
+        return 0;
+    }, -1);
+}
+
+static PyObject * trieGet(PyObject *self, PyObject *args) {
+    PyObject *key;
+    PyObject *fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:get", &key, &fallback)) {
+        return nullptr;
+    }
+    return guard([&] {
+        auto e = TrieImpl::find_ptr(state<TrieState>(self).root, utf8(key));
+        return newRef(e ? e->value.get() : fallback);
+    });
+}
+
+static PyObject * trieSetMethod(PyObject *self, PyObject *args) {
+    PyObject *key, *value;
+    if (!PyArg_ParseTuple(args, "OO:set", &key, &value)) {
+        return nullptr;
+    }
+    return guard([&] {
+        trieSet(self, key, value);
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * trieRemoveMethod(PyObject *self, PyObject *key) {
+    return guard([&] {
+        trieRemove(self, key);
+        Py_RETURN_NONE;
+    });
+}
+
+// All or nothing: on an error the trie keeps its previous version.
+static PyObject * trieUpdate(PyObject *self, PyObject *source) {
+    return guard([&] {
+        auto & s = state<TrieState>(self);
+        TrieState saved = s;
+        try {
+            forEachPair(source, [&](PyObject *key, PyObject *value) {
+                trieSet(self, key, value);
+            });
+        } catch (...) {
+            s = std::move(saved);
+            throw;
+        }
+        Py_RETURN_NONE;
+    });
+}
+
+// Trie lookups never call into Python, so the whole batch runs without the GIL.
+static PyObject * trieFindMany(PyObject *self, PyObject *args) {
+    PyObject *keys;
+    PyObject *fallback = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:find_many", &keys, &fallback)) {
+        return nullptr;
+    }
+    return guard([&] {
+        PyRef seq = PyRef::check(PySequence_Tuple(keys));   // owned, as in hashFindMany
+        Py_ssize_t n = PyTuple_GET_SIZE(seq.get());
+        PyObject **objs = PySequence_Fast_ITEMS(seq.get());
+        std::vector<std::string_view> views(n);
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            views[i] = utf8(objs[i]);
+        }
+
+        std::vector<const TrieEntry *> found(n);
+        auto root = state<TrieState>(self).root;   // pinned while the GIL is released
+        Py_BEGIN_ALLOW_THREADS
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            found[i] = TrieImpl::find_ptr(root, views[i]);
+        }
+        Py_END_ALLOW_THREADS
+
+        PyRef result = PyRef::check(PyList_New(n));
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            PyList_SET_ITEM(result.get(), i, newRef(found[i] ? found[i]->value.get() : fallback));
+        }
+        return result.release();
+    });
+}
+
+// (key, value) for every stored key that is a prefix of `key`, shortest first
+static PyObject * triePrefixes(PyObject *self, PyObject *key) {
+    return guard([&] {
+        auto hits = TrieImpl::findPrefix(state<TrieState>(self).root, utf8(key));
+        PyRef result = PyRef::check(PyList_New(hits.size()));
+        for (size_t i = 0; i < hits.size(); ++i) {
+            PyObject *pair = PyTuple_Pack(2, hits[i].key.get(), hits[i].value.get());
+            if (!pair) {
+                throw PyError();
+            }
+            PyList_SET_ITEM(result.get(), i, pair);
+        }
+        return result.release();
+    });
+}
+
+static PyObject * trieIterMode(PyObject *self, IterMode mode) {
+    return guard([&] {
+        const auto & s = state<TrieState>(self);
+        std::vector<std::pair<PyObject *, PyObject *>> items;
+        items.reserve(s.size);
+        TrieImpl::for_each(s.root, [&](std::string_view, const TrieEntry & e) {
+            items.emplace_back(e.key.get(), e.value.get());
+        });
+        return makeIter(s.root, std::move(items), mode);
+    });
+}
+
+static int trieInit(PyObject *self, PyObject *args, PyObject *kwds) {
+    PyObject *source = nullptr;
+    static const char *names[] = {"source", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:Trie", const_cast<char **>(names), &source)) {
+        return -1;
+    }
+    if (source) {
+        PyObject *r = trieUpdate(self, source);
+        Py_XDECREF(r);
+        return r ? 0 : -1;
+    }
+    return 0;
+}
+
+static PyObject * trieIter(PyObject *self) {
+    return trieIterMode(self, KEYS);
+}
+
+static PyObject * trieValues(PyObject *self, PyObject *) {
+    return trieIterMode(self, VALUES);
+}
+
+static PyObject * trieItems(PyObject *self, PyObject *) {
+    return trieIterMode(self, ITEMS);
+}
+
+static PyMethodDef trieMethods[] = {
+    {"get", trieGet, METH_VARARGS, "get(key, default=None)"},
+    {"set", trieSetMethod, METH_VARARGS, "set(key, value)"},
+    {"remove", trieRemoveMethod, METH_O, "remove(key); KeyError if absent"},
+    {"update", trieUpdate, METH_O, "update(mapping or pairs); all or nothing"},
+    {"find_many", trieFindMany, METH_VARARGS,
+     "find_many(keys, default=None) -> list of values, looked up without the GIL"},
+    {"prefixes", triePrefixes, METH_O, "prefixes(key) -> [(k, v)] for stored keys that prefix key"},
+    {"snapshot", snapshot<TrieState>, METH_NOARGS, "another trie on the current version, in O(1)"},
+    {"values", trieValues, METH_NOARGS, nullptr},
+    {"items", trieItems, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot trieSlots[] = {
+    {Py_tp_doc, const_cast<char *>("Persistent trie over the UTF-8 bytes of str keys, iterated in byte order.")},
+    {Py_tp_new, reinterpret_cast<void *>(newObject<TrieState>)},
+    {Py_tp_init, reinterpret_cast<void *>(trieInit)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<TrieState>)},
+    {Py_tp_traverse, reinterpret_cast<void *>(traverseObject<TrieState>)},
+    {Py_tp_clear, reinterpret_cast<void *>(clearObject<TrieState>)},
+    {Py_tp_iter, reinterpret_cast<void *>(trieIter)},
+    {Py_tp_methods, trieMethods},
+    {Py_mp_length, reinterpret_cast<void *>(trieLength)},
+    {Py_sq_length, reinterpret_cast<void *>(trieLength)},
+    {Py_mp_subscript, reinterpret_cast<void *>(trieSubscript)},
+    {Py_mp_ass_subscript, reinterpret_cast<void *>(trieAssSubscript)},
+    {Py_sq_contains, reinterpret_cast<void *>(trieContains)},
+    {0, nullptr},
+};
+
+static PyType_Spec trieSpec = {
+    "persist.Trie", sizeof(Object<TrieState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, trieSlots,
+};
+
+/*
+ * IndexList: the interface of index_list.py on an RRB vector.
+ */
+
+static Py_ssize_t listLength(PyObject *self) {
+    return ListImpl::size(state<ListState>(self).root);
+}
+
+static PyObject * listItem(PyObject *self, Py_ssize_t i) {
+    return guard([&] {
+        if (i < 0) {
+            throw std::out_of_range("index out of bound");
+        }
+        return newRef(ListImpl::get(state<ListState>(self).root, i).get());
+    });
+}
+
+static PyObject * listGet(PyObject *self, PyObject *index) {
+    return guard([&] {
+        return newRef(ListImpl::get(state<ListState>(self).root, toIndex(index)).get());
+    });
+}
+
+static PyObject * listSet(PyObject *self, PyObject *args) {
+    PyObject *index, *value;
+    if (!PyArg_ParseTuple(args, "OO:set", &index, &value)) {
+        return nullptr;
+    }
+    return guard([&] {
+        auto & s = state<ListState>(self);
+        s.root = ListImpl::set(s.root, toIndex(index), PyRef::borrow(value));
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * listInsert(PyObject *self, PyObject *args) {
+    PyObject *index, *value;
+    if (!PyArg_ParseTuple(args, "OO:insert", &index, &value)) {
+        return nullptr;
+    }
+    return guard([&] {
+        auto & s = state<ListState>(self);
+        s.root = ListImpl::insert(s.root, toIndex(index), PyRef::borrow(value));
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * listRemove(PyObject *self, PyObject *index) {
+    return guard([&] {
+        auto & s = state<ListState>(self);
+        s.root = ListImpl::remove(s.root, toIndex(index));
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * listAppend(PyObject *self, PyObject *value) {
+    return guard([&] {
+        auto & s = state<ListState>(self);
+        s.root = ListImpl::push_back(s.root, PyRef::borrow(value));
+        Py_RETURN_NONE;
+    });
+}
+
+// Appends through a transient; all or nothing.
+static PyObject * listExtend(PyObject *self, PyObject *source) {
+    return guard([&] {
+        auto & s = state<ListState>(self);
+        ListImpl::Transient t(s.root);
+        forEachItem(source, [&](PyObject *value) {
+            t.push_back(PyRef::borrow(value));
+        });
+        s.root = t.persistent();
+        Py_RETURN_NONE;
+    });
+}
+
+static int listInit(PyObject *self, PyObject *args, PyObject *kwds) {
+    PyObject *source = nullptr;
+    static const char *names[] = {"source", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:IndexList", const_cast<char **>(names), &source)) {
+        return -1;
+    }
+    if (source) {
+        PyObject *r = listExtend(self, source);
+        Py_XDECREF(r);
+        return r ? 0 : -1;
+    }
+    return 0;
+}
+
+static PyObject * listIter(PyObject *self) {
+    return guard([&] {
+        const auto & root = state<ListState>(self).root;
+        std::vector<std::pair<PyObject *, PyObject *>> items;
+        items.reserve(ListImpl::size(root));
+        ListImpl::for_each(root, [&](const PyRef & v) {
+            items.emplace_back(v.get(), nullptr);
+        });
+        return makeIter(root, std::move(items), KEYS);
+    });
+}
+
+static PyMethodDef listMethods[] = {
+    {"get", listGet, METH_O, "get(i); IndexError out of range"},
+    {"set", listSet, METH_VARARGS, "set(i, value)"},
+    {"insert", listInsert, METH_VARARGS, "insert(i, value) for 0 <= i <= len"},
+    {"remove", listRemove, METH_O, "remove(i)"},
+    {"append", listAppend, METH_O, "append(value)"},
+    {"extend", listExtend, METH_O, "extend(iterable); all or nothing"},
+    {"snapshot", snapshot<ListState>, METH_NOARGS, "another list on the current version, in O(1)"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot listSlots[] = {
+    {Py_tp_doc, const_cast<char *>("Persistent indexed list on an RRB vector; snapshot() is O(1).")},
+    {Py_tp_new, reinterpret_cast<void *>(newObject<ListState>)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<ListState>)},
+    {Py_tp_traverse, reinterpret_cast<void *>(traverseObject<ListState>)},
+    {Py_tp_clear, reinterpret_cast<void *>(clearObject<ListState>)},
+    {Py_tp_init, reinterpret_cast<void *>(listInit)},
+    {Py_tp_iter, reinterpret_cast<void *>(listIter)},
+    {Py_tp_methods, listMethods},
+    {Py_sq_length, reinterpret_cast<void *>(listLength)},
+    {Py_sq_item, reinterpret_cast<void *>(listItem)},
+    {0, nullptr},
+};
+
+static PyType_Spec listSpec = {
+    "persist.IndexList", sizeof(Object<ListState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, listSlots,
+};
+
+/*
+ * AATree: the interface of aa_tree.py on a B+-tree, ordered by __lt__.
+ */
+
+// A comparison runs Python code, which could reach this tree again while a
+// descent or a node shift is in progress. Such a nested call is refused.
+class Exclusive {
+    TreeState & s_;
+public:
+    explicit Exclusive(PyObject *self) : s_(state<TreeState>(self)) {
+        if (s_.busy) {
+            PyErr_SetString(PyExc_RuntimeError, "AATree used from inside one of its own comparisons");
+            throw PyError();
+        }
+        s_.busy = true;
+    }
+
+    ~Exclusive() {
+        s_.busy = false;
+    }
+
+    TreeImpl & tree() {
+        return s_.tree;
+    }
+};
+
+static Py_ssize_t treeLength(PyObject *self) {
+    return state<TreeState>(self).tree.size();
+}
+
+static int treeContains(PyObject *self, PyObject *key) {
+    return guard([&] {
+        Exclusive t(self);
+        return t.tree().contains(PyRef::borrow(key)) ? 1 : 0;
+    }, -1);
+}
+
+static PyObject * treeGet(PyObject *self, PyObject *key) {
+    return guard([&] {
+        Exclusive t(self);
+        auto v = t.tree().find(PyRef::borrow(key));
+        if (!v) {
+            keyError(key);
+        }
+        return newRef(v->get());
+    });
+}
+
+static PyObject * treeSet(PyObject *self, PyObject *args) {
+    PyObject *key, *value;
+    if (!PyArg_ParseTuple(args, "OO:set", &key, &value)) {
+        return nullptr;
+    }
+    return guard([&] {
+        Exclusive t(self);
+        t.tree().set(PyRef::borrow(key), PyRef::borrow(value));
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * treeRemove(PyObject *self, PyObject *key) {
+    return guard([&] {
+        Exclusive t(self);
+        if (!t.tree().erase(PyRef::borrow(key))) {
+            keyError(key);
+        }
+        Py_RETURN_NONE;
+    });
+}
+
+static PyObject * treeKeys(PyObject *self, PyObject *) {
+    return guard([&] {
+        Exclusive t(self);
+        PyRef result = PyRef::check(PyList_New(t.tree().size()));
+        Py_ssize_t i = 0;
+        for (auto it = t.tree().begin(); it != t.tree().end(); ++it) {
+            PyList_SET_ITEM(result.get(), i++, newRef(it.key().get()));
+        }
+        return result.release();
+    });
+}
+
+// number of keys less than key
+static PyObject * treeRank(PyObject *self, PyObject *key) {
+    return guard([&] {
+        Exclusive t(self);
+        return PyLong_FromSize_t(t.tree().rank(PyRef::borrow(key)));
+    });
+}
+
+// the i-th (key, value) in order
+static PyObject * treeSelect(PyObject *self, PyObject *index) {
+    return guard([&] {
+        Exclusive t(self);
+        auto it = t.tree().select(toIndex(index));
+        return PyTuple_Pack(2, it.key().get(), it.value().get());
+    });
+}
+
+// [(key, value)] for lo <= key < hi
+static PyObject * treeRange(PyObject *self, PyObject *args) {
+    PyObject *lo, *hi;
+    if (!PyArg_ParseTuple(args, "OO:range", &lo, &hi)) {
+        return nullptr;
+    }
+    return guard([&] {
+        Exclusive t(self);
+        PyRef result = PyRef::check(PyList_New(0));
+        t.tree().range(PyRef::borrow(lo), PyRef::borrow(hi), [&](const PyRef & k, const PyRef & v) {
+            PyRef pair = PyRef::check(PyTuple_Pack(2, k.get(), v.get()));
+            if (PyList_Append(result.get(), pair.get()) < 0) {
+                throw PyError();
+            }
+        });
+        return result.release();
+    });
+}
+
+// takes no arguments, as in aa_tree.py
+static int treeInit(PyObject *, PyObject *args, PyObject *kwds) {
+    static const char *names[] = {nullptr};
+    return PyArg_ParseTupleAndKeywords(args, kwds, ":AATree", const_cast<char **>(names)) ? 0 : -1;
+}
+
+// over a copy of the keys, since the tree may change during the iteration
+static PyObject * treeIter(PyObject *self) {
+    PyObject *keys = treeKeys(self, nullptr);
+    if (!keys) {
+        return nullptr;
+    }
+    PyObject *it = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return it;
+}
+
+static PyMethodDef treeMethods[] = {
+    {"get", treeGet, METH_O, "get(key); KeyError if absent"},
+    {"set", treeSet, METH_VARARGS, "set(key, value)"},
+    {"remove", treeRemove, METH_O, "remove(key); KeyError if absent"},
+    {"keys", treeKeys, METH_NOARGS, "sorted list of the keys"},
+    {"rank", treeRank, METH_O, "rank(key) -> number of keys less than key"},
+    {"select", treeSelect, METH_O, "select(i) -> i-th (key, value) in order"},
+    {"range", treeRange, METH_VARARGS, "range(lo, hi) -> [(key, value)] for lo <= key < hi"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyType_Slot treeSlots[] = {
+    {Py_tp_doc, const_cast<char *>("Ordered map on a B+-tree, with rank and select.")},
+    {Py_tp_new, reinterpret_cast<void *>(newObject<TreeState>)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(deallocObject<TreeState>)},
+    {Py_tp_traverse, reinterpret_cast<void *>(traverseObject<TreeState>)},
+    {Py_tp_clear, reinterpret_cast<void *>(clearObject<TreeState>)},
+    {Py_tp_init, reinterpret_cast<void *>(treeInit)},
+    {Py_tp_iter, reinterpret_cast<void *>(treeIter)},
+    {Py_tp_methods, treeMethods},
+    {Py_sq_length, reinterpret_cast<void *>(treeLength)},
+    {Py_sq_contains, reinterpret_cast<void *>(treeContains)},
+    {0, nullptr},
+};
+
+static PyType_Spec treeSpec = {
+    "persist.AATree", sizeof(Object<TreeState>), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, treeSlots,
+};
+
+static PyModuleDef moduleDef = {
+    PyModuleDef_HEAD_INIT, "persist", "Native persistent and ordered containers.", -1,
+    nullptr, nullptr, nullptr, nullptr, nullptr,
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_persist() {
+    PyRef module = PyRef::steal(PyModule_Create(&moduleDef));
+    if (!module) {
+        return nullptr;
+    }
+    if (!IterType) {
+        IterType = reinterpret_cast<PyTypeObject *>(PyType_FromSpec(&iterSpec));
+        if (!IterType) {
+            return nullptr;
+        }
+    }
+    std::pair<const char *, PyType_Spec *> types[] = {
+        {"HAMTMap", &mapSpec},
+        {"HAMTSet", &setSpec},
+        {"Trie", &trieSpec},
+        {"IndexList", &listSpec},
+        {"AATree", &treeSpec},
+    };
+    for (auto [name, spec] : types) {
+        PyObject *type = PyType_FromSpec(spec);
+        if (!type || PyModule_AddObject(module.get(), name, type) < 0) {
+            Py_XDECREF(type);
+            return nullptr;
+        }
+    }
+    return module.release();
+}
@@ -0,0 +1,401 @@
+from persist import HAMTMap, HAMTSet, Trie, IndexList, AATree
+import gc
+import unittest
+import random
+import threading
+import weakref
+
+
+class Collide:
+    """Distinct keys that all share one hash and compare with __eq__."""
+    def __init__(self, v):
+        self.v = v
+
+    def __hash__(self):
+        return 42
+
+    def __eq__(self, other):
+        return isinstance(other, Collide) and self.v == other.v
+
+
+class HAMTMapTest(unittest.TestCase):
+    def test_normal(self):
+        m = HAMTMap()
+        d = {}
+        for i in range(2000):
+            k = random.choice([random.randrange(-5, 5000), str(random.random()), random.random()])
+            v = random.random()
+            d[k] = v
+            m[k] = v
+        self.assertEqual(len(d), len(m))
+        self.assertEqual(set(d), set(m))
+        self.assertEqual(sorted(d.items(), key=repr), sorted(m.items(), key=repr))
+        for k in d:
+            self.assertEqual(d[k], m[k])
+            self.assertIn(k, m)
+
+        keys = list(d)
+        random.shuffle(keys)
+        for k in keys[: len(keys) // 2]:
+            del d[k]
+            m.remove(k)
+        self.assertEqual(len(d), len(m))
+        self.assertEqual(set(d), set(m))
+
+    def test_collisions(self):
+        m = HAMTMap()
+        # hash(-1) == hash(-2), 1 == 1.0 == True
+        m[-1] = 'a'
+        m[-2] = 'b'
+        m[1] = 'c'
+        m[1.0] = 'd'
+        m[True] = 'e'
+        self.assertEqual(len(m), 3)
+        self.assertEqual((m[-1], m[-2], m[1]), ('a', 'b', 'e'))
+        self.assertIs(next(k for k in m if k == 1), 1)   # the first key is kept, as in dict
+
+        for i in range(20):
+            m[Collide(i)] = i
+        self.assertEqual(len(m), 23)
+        for i in range(20):
+            self.assertEqual(m[Collide(i)], i)
+        del m[Collide(7)]
+        self.assertNotIn(Collide(7), m)
+        self.assertEqual(m.find_many([Collide(3), Collide(7), -2], 'x'), [3, 'x', 'b'])
+
+    def test_exception(self):
+        m = HAMTMap()
+        m[0] = 0
+        with self.assertRaises(KeyError):
+            m[1]
+        with self.assertRaises(KeyError):
+            m.remove(1)
+        with self.assertRaises(KeyError):
+            m.remove((1, 2))
+        with self.assertRaises(TypeError):
+            m[[]] = 1
+        self.assertEqual(m.get(1), None)
+        self.assertEqual(m.get(1, 'x'), 'x')
+        # iterators come only from iter()
+        with self.assertRaises(TypeError):
+            type(iter(m))()
+
+    def test_snapshot(self):
+        m = HAMTMap({i: i for i in range(100)})
+        s = m.snapshot()
+        for i in range(50):
+            m[i] = -i
+        del m[99]
+        self.assertEqual(len(s), 100)
+        self.assertEqual([s[i] for i in range(100)], list(range(100)))
+        self.assertEqual(len(m), 99)
+        self.assertEqual(m[10], -10)
+
+    def test_update(self):
+        m = HAMTMap()
+        m.update({'a': 1, 'b': 2})
+        m.update([('b', 3), ('c', 4)])
+        self.assertEqual(dict(m.items()), {'a': 1, 'b': 3, 'c': 4})
+        # all or nothing
+        with self.assertRaises(TypeError):
+            m.update([('d', 5), ([], 6)])
+        self.assertEqual(len(m), 3)
+        self.assertNotIn('d', m)
+
+    def test_find_many(self):
+        m = HAMTMap((i, str(i)) for i in range(1000))
+        m['x' * 20] = 'long'
+        m[b'raw'] = 'bytes'
+        m[2 ** 80] = 'big'
+        queries = list(range(-10, 1010)) + ['x' * 20, b'raw', 2 ** 80, 'raw', 1.0]
+        expect = [m.get(k) for k in queries]
+        self.assertEqual(m.find_many(queries), expect)
+        self.assertEqual(m.find_many(iter([5, 'nope']), 0), ['5', 0])
+
+    def test_find_many_mutation(self):
+        m = HAMTMap({Collide(i): i for i in range(3)})
+        queries = []
+
+        class Clearing(Collide):
+            __hash__ = Collide.__hash__
+
+            def __eq__(self, other):
+                queries.clear()   # drops the only other reference to every query
+                return Collide.__eq__(self, other)
+
+        queries.extend(Clearing(i) for i in range(3))
+        self.assertEqual(m.find_many(queries), [0, 1, 2])
+
+    def test_reentrant(self):
+        # __eq__ changing the map mid-update must not split len() from the contents
+        m = HAMTMap()
+
+        class Meddle(Collide):
+            __hash__ = Collide.__hash__
+
+            def __eq__(self, other):
+                if isinstance(other, Collide) and other.v == 0:
+                    m['meddled'] = True
+                    m['also'] = True
+                return Collide.__eq__(self, other)
+
+        m[Collide(0)] = 0
+        m[Meddle(1)] = 1
+        self.assertEqual(len(m), len(list(m)))
+        m.remove(Meddle(1))
+        self.assertEqual(len(m), len(list(m)))
+
+        s = HAMTSet()
+
+        class Twice(Collide):
+            __hash__ = Collide.__hash__
+
+            def __eq__(self, other):
+                s.discard(Collide(self.v))   # the same key, removed from inside
+                return Collide.__eq__(self, other)
+
+        s.add(Collide(0))
+        s.add(Collide(1))
+        s.discard(Twice(1))
+        self.assertEqual(len(s), len(list(s)))
+
+    def test_threads(self):
+        m = HAMTMap((i, i) for i in range(10000))
+        errors = []
+
+        def reader():
+            for _ in range(20):
+                r = m.find_many(range(10000))
+                if any(x is not None and x != i and x != -i for i, x in enumerate(r)):
+                    errors.append(r)
+
+        threads = [threading.Thread(target=reader) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for i in range(10000):
+            m[i] = -i
+        for t in threads:
+            t.join()
+        self.assertEqual(errors, [])
+
+
+class HAMTSetTest(unittest.TestCase):
+    def test_normal(self):
+        s = HAMTSet(range(100))
+        s.add(5)
+        s.add(Collide(1))
+        s.add(Collide(1))
+        self.assertEqual(len(s), 101)
+        self.assertIn(Collide(1), s)
+        s.remove(Collide(1))
+        s.discard(1000)
+        with self.assertRaises(KeyError):
+            s.remove(1000)
+        self.assertEqual(sorted(s), list(range(100)))
+
+        snap = s.snapshot()
+        s.update(range(100, 200))
+        self.assertEqual(len(snap), 100)
+        self.assertEqual(len(s), 200)
+
+        k = 'interned' + str(len(s))
+        s.add(k)
+        found = s.find_many(['interned200', 'missing'])
+        self.assertIs(found[0], k)
+        self.assertIsNone(found[1])
+
+
+class TrieTest(unittest.TestCase):
+    def test_normal(self):
+        t = Trie()
+        d = {}
+        for i in range(1000):
+            k = str(random.randrange(100000))
+            d[k] = i
+            t[k] = i
+        t['日本'] = 'unicode'
+        d['日本'] = 'unicode'
+        self.assertEqual(len(t), len(d))
+        # byte order of UTF-8 is code point order
+        self.assertEqual(list(t), sorted(d))
+        self.assertEqual(list(t.items()), sorted(d.items()))
+        self.assertEqual(t.find_many(list(d) + ['x']), list(d.values()) + [None])
+
+        snap = t.snapshot()
+        for k in list(d)[:500]:
+            del t[k]
+        self.assertEqual(len(t), len(d) - 500)
+        self.assertEqual(len(snap), len(d))
+
+    def test_prefixes(self):
+        t = Trie({'': 0, 'a': 1, 'ab': 2, 'abcd': 4, 'b': 5})
+        self.assertEqual(t.prefixes('abc'), [('', 0), ('a', 1), ('ab', 2)])
+
+    def test_exception(self):
+        t = Trie()
+        with self.assertRaises(KeyError):
+            t['a']
+        with self.assertRaises(KeyError):
+            t.remove('a')
+        with self.assertRaises(TypeError):
+            t[b'a'] = 1
+        with self.assertRaises(TypeError):
+            t.update([('a', 1), (2, 2)])
+        self.assertEqual(len(t), 0)
+        self.assertNotIn('a', t)
+
+
+class IndexListTest(unittest.TestCase):
+    def test_normal(self):
+        a = IndexList()
+        b = []
+        for i in range(3000):
+            j = random.randrange(len(b) + 1)
+            a.insert(j, i)
+            b.insert(j, i)
+            if i % 3 == 0:
+                j = random.randrange(len(b))
+                a.remove(j)
+                b.pop(j)
+        self.assertEqual(list(a), b)
+        self.assertEqual(a[-1], b[-1])
+
+        snap = a.snapshot()
+        a.extend(range(10))
+        a.set(0, 'first')
+        self.assertEqual(list(snap), b)
+        self.assertEqual(list(a), ['first'] + b[1:] + list(range(10)))
+
+    def test_init(self):
+        self.assertEqual(list(IndexList([1, 2])), [1, 2])
+        self.assertEqual(list(IndexList(source=range(3))), [0, 1, 2])
+        self.assertEqual(len(IndexList()), 0)
+        with self.assertRaises(TypeError):
+            IndexList([1], [2])
+
+    def test_exception(self):
+        a = IndexList()
+        a.append(1)
+        with self.assertRaises(IndexError):
+            a.get(-1)
+        with self.assertRaises(IndexError):
+            a[1]
+        with self.assertRaises(IndexError):
+            a.insert(3, 0)
+
+
+class AATreeTest(unittest.TestCase):
+    def test_init(self):
+        self.assertEqual(len(AATree()), 0)
+        with self.assertRaises(TypeError):
+            AATree([1, 2])
+
+    def test_order_statistics(self):
+        t = AATree()
+        keys = random.sample(range(100000), 2000)
+        for k in keys:
+            t.set(k, -k)
+        keys.sort()
+        self.assertEqual(list(t), keys)
+        for i in range(0, len(keys), 37):
+            self.assertEqual(t.rank(keys[i]), i)
+            self.assertEqual(t.select(i), (keys[i], -keys[i]))
+        with self.assertRaises(IndexError):
+            t.select(len(keys))
+        lo, hi = keys[100], keys[200]
+        self.assertEqual(t.range(lo, hi), [(k, -k) for k in keys[100:200]])
+
+    def test_reentrant(self):
+        t = AATree()
+
+        class Evil:
+            def __init__(self, v):
+                self.v = v
+
+            def __lt__(self, other):
+                t.set(Evil(-1), None)
+                return self.v < other.v
+
+        t.set(Evil(0), 0)
+        with self.assertRaises(RuntimeError):
+            t.set(Evil(1), 1)
+        self.assertEqual(len(t), 1)
+
+    def test_incomparable(self):
+        t = AATree()
+        t.set(1, 1)
+        with self.assertRaises(TypeError):
+            t.set('a', 2)
+        self.assertEqual(t.keys(), [1])
+
+
+
+class Box:
+    pass
+
+
+class Ranked(Box):
+    def __init__(self, n):
+        self.n = n
+
+    def __lt__(self, other):
+        return self.n < other.n
+
+
+class CycleTest(unittest.TestCase):
+    def assertCollected(self, make):
+        box = Box()
+        box.owner = make(box)
+        ref = weakref.ref(box)
+        del box
+        gc.collect()
+        self.assertIsNone(ref())
+
+    def test_collected(self):
+        def index_list(b):
+            a = IndexList()
+            a.append(b)
+            return a
+
+        def aa_tree(b):
+            t = AATree()
+            t.set(1, b)
+            return t
+
+        self.assertCollected(lambda b: HAMTMap({'box': b}))
+        self.assertCollected(lambda b: HAMTSet([b]))
+        self.assertCollected(lambda b: Trie({'box': b}))
+        self.assertCollected(index_list)
+        self.assertCollected(aa_tree)
+
+    def test_separator_keys(self):
+        # keys copied into inner nodes as separators are reported as well
+        boxes = [Ranked(i) for i in range(500)]
+        tree = AATree()
+        for b in boxes:
+            b.owner = tree
+            tree.set(b, None)
+        for b in boxes[::3]:
+            tree.remove(b)
+        refs = [weakref.ref(b) for b in boxes]
+        del boxes, tree, b
+        gc.collect()
+        self.assertTrue(all(r() is None for r in refs))
+
+    def test_shared_version(self):
+        # a version two handles share is reported by neither, so the cycle
+        # waits until the snapshot goes
+        box = Box()
+        box.owner = HAMTMap({'box': box})
+        snap = box.owner.snapshot()
+        ref = weakref.ref(box)
+        del box
+        gc.collect()
+        self.assertIsNotNone(ref())
+        del snap
+        gc.collect()
+        self.assertIsNone(ref())
+
+
+if __name__ == '__main__':
+    unittest.main()
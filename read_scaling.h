@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Read throughput as threads are added, all reading one shared version.
+ *
+ * `counted` is a lookup that copies owning pointers on its way down (the
+ * baseline), `borrowed` is the find_ptr path that touches no reference
+ * count. Every key must be present. With counted lookups every reader
+ * writes the reference counts of the hot upper nodes, so those cache lines
+ * bounce between cores; borrowed lookups leave them shared.
+ */
+template <typename Counted, typename Borrowed>
+void read_scaling(const std::vector<std::string> & keys, Counted counted, Borrowed borrowed) {
+    const size_t limit = keys.size();
+
+    auto run = [&](size_t threads, bool borrow) {
+        const size_t rounds = 16;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> found{0};
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                size_t n = 0;
+                for (size_t r = 0; r < rounds; ++r) {
+                    for (size_t i = 0; i < limit; ++i) {
+                        const auto & key = keys[(i + t * 4099) % limit];
+                        n += borrow ? borrowed(key) : counted(key);
+                    }
+                }
+                found += n;
+            });
+        }
+        for (auto & w : workers) {
+            w.join();
+        }
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        assert(found == threads * rounds * limit);
+        return threads * rounds * limit / sec / 1e6;
+    };
+
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "threads  counted Mops/s  borrowed Mops/s  (per thread)\n";
+    for (size_t threads = 1; threads <= cores; threads *= 2) {
+        double copied = run(threads, false);
+        double shared = run(threads, true);
+        std::cout << threads << "  " << copied << " (" << copied / threads << ")  "
+                  << shared << " (" << shared / threads << ")\n";
+    }
+}
@@ -0,0 +1,362 @@
+#include "rrb_vector.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+using IntVector = RRBVector<int>;
+
+template <typename Vector>
+static void assertEqual(const typename Vector::Pointer & p, const std::vector<int> & b) {
+    assert(Vector::size(p) == b.size());
+    for (size_t i = 0; i < b.size(); ++i) {
+        assert(Vector::get(p, i) == b[i]);
+    }
+    size_t i = 0;
+    Vector::for_each(p, [&](int v) {
+        assert(v == b[i++]);
+    });
+    assert(i == b.size());
+}
+
+// the scenario of index_list_test.py
+void test_normal() {
+    auto a = IntVector::create();
+    std::vector<int> b;
+    for (int i = 0; i < 1000; ++i) {
+        a = IntVector::insert(a, IntVector::size(a), i);
+        b.push_back(i);
+    }
+    assertEqual<IntVector>(a, b);
+
+    a = IntVector::insert(a, 2, -1);
+    b.insert(b.begin() + 2, -1);
+    assertEqual<IntVector>(a, b);
+
+    a = IntVector::remove(a, 5);
+    b.erase(b.begin() + 5);
+    assertEqual<IntVector>(a, b);
+}
+
+void test_exception() {
+    auto a = IntVector::create();
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (const std::out_of_range &) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([&] { IntVector::get(a, 0); }));
+    assert(throws([&] { IntVector::insert(a, 1, 0); }));
+    a = IntVector::insert(a, 0, 0);
+    assert(IntVector::get(a, 0) == 0);
+    assert(throws([&] { IntVector::remove(a, 1); }));
+    assert(throws([&] { IntVector::slice(a, 1, 0); }));
+    a = IntVector::remove(a, 0);
+    assert(IntVector::size(a) == 0);
+    assert(throws([&] { IntVector::pop_back(a); }));
+}
+
+// random splices against std::vector; every old version stays intact
+template <typename Vector>
+void test_random() {
+    std::mt19937 rng(7);
+    auto a = Vector::create();
+    std::vector<int> b;
+    std::vector<std::pair<typename Vector::Pointer, std::vector<int>>> versions;
+    for (int step = 0; step < 20000; ++step) {
+        size_t n = b.size();
+        switch (rng() % 6) {
+            case 0:
+            case 1: {
+                size_t i = rng() % (n + 1);
+                a = Vector::insert(a, i, step);
+                b.insert(b.begin() + i, step);
+                break;
+            }
+            case 2:
+                a = Vector::push_back(a, step);
+                b.push_back(step);
+                break;
+            case 3:
+                if (n) {
+                    size_t i = rng() % n;
+                    a = Vector::remove(a, i);
+                    b.erase(b.begin() + i);
+                }
+                break;
+            case 4:
+                if (n) {
+                    size_t i = rng() % n;
+                    a = Vector::set(a, i, -step);
+                    b[i] = -step;
+                }
+                break;
+            case 5:
+                if (n) {
+                    a = Vector::pop_back(a);
+                    b.pop_back();
+                }
+                break;
+        }
+        if (step % 97 == 0) {
+            assert(Vector::size(a) == b.size());
+            for (size_t i = 0; i < b.size(); i += 13) {
+                assert(Vector::get(a, i) == b[i]);
+            }
+        }
+        if (step % 1000 == 0) {
+            versions.emplace_back(a, b);
+        }
+    }
+    assertEqual<Vector>(a, b);
+    for (const auto & [p, v] : versions) {
+        assertEqual<Vector>(p, v);
+    }
+
+    // grow, then shrink by removes: the levels must go as the elements do
+    a = Vector::create();
+    b.clear();
+    for (int i = 0; i < int(Vector::WIDTH * Vector::WIDTH * Vector::WIDTH); ++i) {
+        size_t at = rng() % (b.size() + 1);
+        a = Vector::insert(a, at, i);
+        b.insert(b.begin() + at, i);
+    }
+    auto grown = a;
+    auto full = b;
+    assert(Vector::height(a) >= 4);
+    while (b.size() > 1) {
+        size_t i = rng() % b.size();
+        a = Vector::remove(a, i);
+        b.erase(b.begin() + i);
+        size_t dense = 1;
+        for (size_t cap = Vector::WIDTH; cap < b.size(); cap *= Vector::WIDTH) {
+            ++dense;
+        }
+        assert(Vector::height(a) <= dense + 1);
+    }
+    assertEqual<Vector>(a, b);
+    assertEqual<Vector>(grown, full);
+}
+
+template <typename Vector>
+void test_concat_split() {
+    std::mt19937 rng(11);
+    const int pieces = 200;
+    std::vector<typename Vector::Pointer> parts;
+    std::vector<std::vector<int>> expect;
+    int next = 0;
+    for (int i = 0; i < pieces; ++i) {
+        auto p = Vector::create();
+        std::vector<int> b;
+        size_t len = rng() % (3 * Vector::WIDTH + 2);
+        for (size_t j = 0; j < len; ++j) {
+            p = Vector::push_back(p, next);
+            b.push_back(next++);
+        }
+        parts.push_back(p);
+        expect.push_back(b);
+    }
+
+    // fold the pieces together in random order of adjacent pairs
+    while (parts.size() > 1) {
+        size_t i = rng() % (parts.size() - 1);
+        parts[i] = Vector::concat(parts[i], parts[i + 1]);
+        expect[i].insert(expect[i].end(), expect[i + 1].begin(), expect[i + 1].end());
+        parts.erase(parts.begin() + i + 1);
+        expect.erase(expect.begin() + i + 1);
+        assert(Vector::size(parts[i]) == expect[i].size());
+    }
+    auto all = parts[0];
+    const auto & b = expect[0];
+    assertEqual<Vector>(all, b);
+
+    // a dense tree of this size is 2 or 3 levels; concatenation may add one
+    size_t dense = 1;
+    for (size_t cap = Vector::WIDTH; cap < b.size(); cap *= Vector::WIDTH) {
+        ++dense;
+    }
+    assert(Vector::height(all) <= dense + 1);
+
+    for (int round = 0; round < 200; ++round) {
+        size_t from = rng() % (b.size() + 1);
+        size_t to = from + rng() % (b.size() - from + 1);
+        auto s = Vector::slice(all, from, to);
+        assert(Vector::size(s) == to - from);
+        for (size_t i = from; i < to; i += 7) {
+            assert(Vector::get(s, i - from) == b[i]);
+        }
+        auto [l, r] = Vector::split_at(all, from);
+        assert(Vector::size(l) == from && Vector::size(r) == b.size() - from);
+        auto back = Vector::concat(l, r);
+        for (size_t i = 0; i < b.size(); i += 11) {
+            assert(Vector::get(back, i) == b[i]);
+        }
+    }
+
+    // Splicing the same sequence apart and back together leaves underfull
+    // nodes at the seams. Two spare nodes per level cost a 32-wide tree
+    // little, but can halve the fill of a 4-wide one.
+    auto p = all;
+    for (int round = 0; round < 2000; ++round) {
+        size_t i = rng() % (b.size() + 1);
+        auto [l, r] = Vector::split_at(p, i);
+        p = Vector::concat(l, r);
+    }
+    assertEqual<Vector>(p, b);
+    assert(Vector::height(p) <= (Vector::WIDTH < 32 ? 2 * dense : dense + 1));
+}
+
+void test_transient() {
+    auto base = IntVector::create();
+    for (int i = 0; i < 100; ++i) {
+        base = IntVector::push_back(base, i);
+    }
+
+    IntVector::Transient t(base);
+    for (int i = 100; i < 10000; ++i) {
+        t.push_back(i);
+    }
+    for (size_t i = 0; i < t.size(); i += 3) {
+        t.set(i, -int(i));
+    }
+    auto a = t.persistent();
+
+    // edits after publishing copy again
+    t.set(1, 12345);
+    t.push_back(10000);
+    auto b = t.persistent();
+
+    assert(IntVector::size(base) == 100);
+    for (int i = 0; i < 100; ++i) {
+        assert(IntVector::get(base, i) == i);
+    }
+    assert(IntVector::size(a) == 10000 && IntVector::size(b) == 10001);
+    for (int i = 0; i < 10000; ++i) {
+        int want = i % 3 == 0 ? -i : i;
+        assert(IntVector::get(a, i) == want);
+        assert(IntVector::get(b, i) == (i == 1 ? 12345 : want));
+        assert(t.get(i) == IntVector::get(b, i));
+    }
+    assert(IntVector::get(b, 10000) == 10000);
+
+    // a moved transient keeps editing what it owned; copies do not exist
+    static_assert(!std::is_copy_constructible_v<IntVector::Transient>);
+    static_assert(!std::is_copy_assignable_v<IntVector::Transient>);
+    IntVector::Transient u(std::move(t));
+    u.set(2, 54321);
+    assert(u.get(2) == 54321 && u.get(1) == 12345);
+    assert(IntVector::get(b, 2) == 2);
+}
+
+void test_for_each_owned() {
+    auto p = IntVector::create();
+    for (int i = 0; i < 1000; ++i) {
+        p = IntVector::push_back(p, i);
+    }
+    size_t n = 0;
+    auto visit = [&](int) {
+        ++n;
+    };
+    IntVector::for_each_owned(p, visit);
+    assert(n == 1000);
+
+    // the copied leaf and the tail are each reached from one version only
+    auto q = IntVector::set(p, 0, -1);
+    n = 0;
+    IntVector::for_each_owned(p, visit);
+    IntVector::for_each_owned(q, visit);
+    assert(n == 2 * IntVector::WIDTH);
+
+    auto r = q;
+    n = 0;
+    IntVector::for_each_owned(q, visit);
+    assert(n == 0);
+}
+
+void test_strings() {
+    using StringVector = RRBVector<std::string, 6>;
+    auto p = StringVector::create();
+    for (int i = 0; i < 5000; ++i) {
+        p = StringVector::insert(p, i / 2, std::to_string(i));
+    }
+    auto q = StringVector::slice(p, 100, 4100);
+    auto r = StringVector::concat(q, StringVector::take(p, 100));
+    assert(StringVector::size(r) == 4100);
+    for (size_t i = 0; i < 4000; ++i) {
+        assert(StringVector::get(r, i) == StringVector::get(p, i + 100));
+    }
+    for (size_t i = 0; i < 100; ++i) {
+        assert(StringVector::get(r, 4000 + i) == StringVector::get(p, i));
+    }
+}
+
+template <typename Vector>
+static void bench_vector(const char *name) {
+    const size_t limit = 1 << 20;
+    std::mt19937 rng(1);
+    auto time = [](auto f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto p = Vector::create();
+    double push = time([&] {
+        for (size_t i = 0; i < limit; ++i) {
+            p = Vector::push_back(p, i);
+        }
+    });
+    typename Vector::Transient t;
+    double transient = time([&] {
+        for (size_t i = 0; i < limit; ++i) {
+            t.push_back(i);
+        }
+        t.persistent();
+    });
+    size_t sum = 0;
+    double get = time([&] {
+        for (size_t i = 0; i < limit; ++i) {
+            sum += Vector::get(p, rng() % limit);
+        }
+    });
+    const size_t splices = 1 << 14;
+    double splice = time([&] {
+        for (size_t i = 0; i < splices; ++i) {
+            p = Vector::insert(p, rng() % Vector::size(p), i);
+            p = Vector::remove(p, rng() % Vector::size(p));
+        }
+    });
+    double get_relaxed = time([&] {
+        for (size_t i = 0; i < limit; ++i) {
+            sum += Vector::get(p, rng() % limit);
+        }
+    });
+    std::cout << name << " Mops/s: push_back " << limit / push / 1e6
+              << ", transient push_back " << limit / transient / 1e6
+              << ", get " << limit / get / 1e6
+              << ", insert+remove " << 2 * splices / splice / 1e6
+              << ", get after splices " << limit / get_relaxed / 1e6
+              << " (height " << Vector::height(p) << ", checksum " << sum % 10 << ")\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        bench_vector<RRBVector<int, 5>>("32-wide");
+        bench_vector<RRBVector<int, 6>>("64-wide");
+        return 0;
+    }
+    test_normal();
+    test_exception();
+    test_random<RRBVector<int, 5>>();
+    test_random<RRBVector<int, 2>>();
+    test_concat_split<RRBVector<int, 5>>();
+    test_concat_split<RRBVector<int, 2>>();
+    test_transient();
+    test_for_each_owned();
+    test_strings();
+}
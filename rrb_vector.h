@@ -0,0 +1,700 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ownership.h"
+
+/*
+ * Persistent indexed sequence: a relaxed radix-balanced tree (Bagwell and
+ * Rompf, "RRB-Trees: Efficient Immutable Vectors").
+ *
+ * Nodes are 2^Bits wide. A node whose children are all full except the
+ * last is regular and is indexed by shifting. Splits and concatenations
+ * leave relaxed nodes behind, and those carry a cumulative size table. A
+ * concatenation rebalances the nodes along the seam, so a lookup takes at
+ * most EXTRAS more steps per level than it would in a dense tree.
+ *
+ * The last elements live in a separate tail leaf. push_back only copies
+ * that tail, and the tail joins the tree once it is full. insert and remove
+ * copy one path as in a B-tree: a leaf or node that overflows splits in
+ * half, and one that falls under half full on the path of a remove joins
+ * a neighbour, so the tree loses a level as it shrinks.
+ *
+ * Transient batches edits on one thread. Nodes it has copied carry its
+ * owner id and are edited in place. persistent() publishes a version and
+ * takes a fresh id, so those nodes are never written again.
+ */
+template <typename T, size_t Bits = 5, typename Policy = AtomicRefCount<>>
+class RRBVector {
+    static_assert(Bits >= 2 && Bits <= 6, "nodes are 4 to 64 wide");
+public:
+    template <typename U>
+    using Ptr = typename Policy::template Ptr<U>;
+
+    using Pointer = Ptr<const RRBVector>;
+
+    static constexpr size_t WIDTH = size_t(1) << Bits;
+
+private:
+    static constexpr size_t EXTRAS = 2;   // extra search steps a concat may leave per level
+
+    struct Node;
+    using NodePtr = Ptr<Node>;
+
+    struct Node {
+        std::vector<T> values;        // leaves
+        std::vector<NodePtr> kids;    // inner nodes
+        std::vector<size_t> sizes;    // cumulative element counts; empty when regular
+        uint64_t owner = 0;           // the transient allowed to edit in place
+    };
+
+    NodePtr root_;     // null when every element is in the tail
+    size_t height_;    // of root_; leaves are height 0
+    size_t size_;
+    NodePtr tail_;     // null or a leaf with 1..WIDTH values
+
+    // elements under a node of height h when it is full
+    static size_t capacity(size_t h) {
+        return size_t(1) << (Bits * (h + 1));
+    }
+
+    static size_t slots(const Node & n, size_t h) {
+        return h ? n.kids.size() : n.values.size();
+    }
+
+    static size_t count(const Node & n, size_t h) {
+        if (h == 0) {
+            return n.values.size();
+        }
+        if (!n.sizes.empty()) {
+            return n.sizes.back();
+        }
+        return (n.kids.size() - 1) * capacity(h - 1) + count(*n.kids.back(), h - 1);
+    }
+
+    // the child of an inner node holding element i, and i's offset within it
+    static std::pair<size_t, size_t> locate(const Node & n, size_t h, size_t i) {
+        size_t k = i >> (Bits * h);
+        if (n.sizes.empty()) {
+            return {k, i - k * capacity(h - 1)};
+        }
+        while (n.sizes[k] <= i) {
+            ++k;
+        }
+        return {k, k ? i - n.sizes[k - 1] : i};
+    }
+
+    static NodePtr build(std::vector<T> && values, size_t) {
+        auto n = Policy::template make<Node>();
+        n->values = std::move(values);
+        return n;
+    }
+
+    // an inner node of height h; the size table is dropped when it is regular
+    static NodePtr build(std::vector<NodePtr> && kids, size_t h) {
+        assert(h > 0 && !kids.empty() && kids.size() <= WIDTH);
+        auto n = Policy::template make<Node>();
+        bool regular = h == 1 || kids.back()->sizes.empty();
+        size_t sizes[WIDTH];
+        size_t total = 0;
+        for (size_t k = 0; k < kids.size(); ++k) {
+            size_t c = count(*kids[k], h - 1);
+            regular = regular && (k + 1 == kids.size() || c == capacity(h - 1));
+            total += c;
+            sizes[k] = total;
+        }
+        if (!regular) {
+            n->sizes.assign(sizes, sizes + kids.size());
+        }
+        n->kids = std::move(kids);
+        return n;
+    }
+
+    static Pointer make(NodePtr root, size_t height, size_t size, NodePtr tail) {
+        return Policy::template make<RRBVector>(std::move(root), height, size, std::move(tail));
+    }
+
+    size_t tailSize() const {
+        return tail_ ? tail_->values.size() : 0;
+    }
+
+    size_t treeSize() const {
+        return size_ - tailSize();
+    }
+
+    static const T & lookup(const Node * n, size_t h, size_t i) {
+        while (h > 0) {
+            auto [k, off] = locate(*n, h, i);
+            n = n->kids[k].get();
+            i = off;
+            --h;
+        }
+        return n->values[i];
+    }
+
+    /*
+     * Concatenation. concatSub returns a node one level above the taller
+     * input, holding one or two nodes; the caller unwraps it.
+     */
+    static std::pair<NodePtr, size_t> concatTrees(const NodePtr & a, size_t ha, const NodePtr & b, size_t hb) {
+        if (!a) {
+            return {b, hb};
+        }
+        if (!b) {
+            return {a, ha};
+        }
+        size_t h = std::max(ha, hb);
+        auto wrapper = concatSub(a, ha, b, hb, true);
+        if (wrapper->kids.size() == 1) {
+            return {wrapper->kids[0], h};
+        }
+        return {wrapper, h + 1};
+    }
+
+    static NodePtr concatSub(const NodePtr & a, size_t ha, const NodePtr & b, size_t hb, bool top) {
+        if (ha > hb) {
+            auto mid = concatSub(a->kids.back(), ha - 1, b, hb, false);
+            return rebalance(a.get(), *mid, nullptr, ha);
+        }
+        if (ha < hb) {
+            auto mid = concatSub(a, ha, b->kids.front(), hb - 1, false);
+            return rebalance(nullptr, *mid, b.get(), hb);
+        }
+        if (ha == 0) {
+            if (top && a->values.size() + b->values.size() <= WIDTH) {
+                std::vector<T> values(a->values);
+                values.insert(values.end(), b->values.begin(), b->values.end());
+                return build(std::vector<NodePtr>{build(std::move(values), 0)}, 1);
+            }
+            return build(std::vector<NodePtr>{a, b}, 1);
+        }
+        auto mid = concatSub(a->kids.back(), ha - 1, b->kids.front(), hb - 1, false);
+        return rebalance(a.get(), *mid, b.get(), ha);
+    }
+
+    // Merges the children of a (minus its last), mid and b (minus its first),
+    // all of height h - 1, into at most two nodes of height h.
+    static NodePtr rebalance(const Node * a, const Node & mid, const Node * b, size_t h) {
+        std::vector<NodePtr> all;
+        all.reserve(2 * WIDTH);
+        if (a) {
+            all.insert(all.end(), a->kids.begin(), a->kids.end() - 1);
+        }
+        all.insert(all.end(), mid.kids.begin(), mid.kids.end());
+        if (b) {
+            all.insert(all.end(), b->kids.begin() + 1, b->kids.end());
+        }
+
+        auto plan = concatPlan(all, h - 1);
+        std::vector<NodePtr> merged = h == 1
+            ? distribute(all, plan, &Node::values, 0)
+            : distribute(all, plan, &Node::kids, h - 1);
+
+        std::vector<NodePtr> left(merged.begin(), merged.begin() + std::min(merged.size(), WIDTH));
+        std::vector<NodePtr> up{build(std::move(left), h)};
+        if (merged.size() > WIDTH) {
+            up.push_back(build(std::vector<NodePtr>(merged.begin() + WIDTH, merged.end()), h));
+        }
+        return build(std::move(up), h + 1);
+    }
+
+    // Slot counts for the merged nodes: underfull nodes are emptied into
+    // their right neighbours until at most EXTRAS more nodes remain than a
+    // dense packing would need.
+    static std::vector<size_t> concatPlan(const std::vector<NodePtr> & all, size_t h) {
+        std::vector<size_t> plan;
+        size_t total = 0;
+        for (const auto & n : all) {
+            plan.push_back(slots(*n, h));
+            total += plan.back();
+        }
+        size_t optimal = (total + WIDTH - 1) / WIDTH;
+        size_t n = plan.size();
+        size_t i = 0;
+        while (n > optimal + EXTRAS) {
+            while (plan[i] > WIDTH - EXTRAS / 2) {
+                ++i;
+            }
+            size_t remaining = plan[i];
+            do {
+                assert(i + 1 < n);
+                size_t fill = std::min(remaining + plan[i + 1], WIDTH);
+                remaining = remaining + plan[i + 1] - fill;
+                plan[i] = fill;
+                ++i;
+            } while (remaining > 0);
+            std::copy(plan.begin() + i + 1, plan.begin() + n, plan.begin() + i);
+            --n;
+            --i;
+        }
+        plan.resize(n);
+        return plan;
+    }
+
+    // Lays the slots of `all` out according to `plan`. A node that lines
+    // up with its planned slot unchanged is shared, not copied.
+    template <typename S>
+    static std::vector<NodePtr> distribute(const std::vector<NodePtr> & all, const std::vector<size_t> & plan,
+                                           std::vector<S> Node::* field, size_t h) {
+        std::vector<NodePtr> out;
+        out.reserve(plan.size());
+        size_t src = 0, offset = 0;
+        for (size_t want : plan) {
+            const auto & first = (*all[src]).*field;
+            if (offset == 0 && first.size() == want) {
+                out.push_back(all[src++]);
+                continue;
+            }
+            std::vector<S> slots;
+            slots.reserve(want);
+            while (slots.size() < want) {
+                const auto & from = (*all[src]).*field;
+                size_t take = std::min(want - slots.size(), from.size() - offset);
+                slots.insert(slots.end(), from.begin() + offset, from.begin() + offset + take);
+                offset += take;
+                if (offset == from.size()) {
+                    ++src;
+                    offset = 0;
+                }
+            }
+            out.push_back(build(std::move(slots), h));
+        }
+        assert(src == all.size());
+        return out;
+    }
+
+    // the first n elements of a node, 0 < n < count
+    static NodePtr takeTree(const NodePtr & node, size_t h, size_t n) {
+        if (h == 0) {
+            return build(std::vector<T>(node->values.begin(), node->values.begin() + n), 0);
+        }
+        auto [k, off] = locate(*node, h, n - 1);
+        const auto & kid = node->kids[k];
+        std::vector<NodePtr> kids(node->kids.begin(), node->kids.begin() + k);
+        kids.push_back(off + 1 == count(*kid, h - 1) ? kid : takeTree(kid, h - 1, off + 1));
+        return build(std::move(kids), h);
+    }
+
+    // everything after the first n elements of a node, 0 < n < count
+    static NodePtr dropTree(const NodePtr & node, size_t h, size_t n) {
+        if (h == 0) {
+            return build(std::vector<T>(node->values.begin() + n, node->values.end()), 0);
+        }
+        auto [k, off] = locate(*node, h, n);
+        const auto & kid = node->kids[k];
+        std::vector<NodePtr> kids{off == 0 ? kid : dropTree(kid, h - 1, off)};
+        kids.insert(kids.end(), node->kids.begin() + k + 1, node->kids.end());
+        return build(std::move(kids), h);
+    }
+
+    // Inserts before element i. A node pushed over WIDTH splits in half and
+    // the right half comes back as the second member.
+    static std::pair<NodePtr, NodePtr> insertTree(const NodePtr & node, size_t h, size_t i, const T & value) {
+        if (h == 0) {
+            std::vector<T> values;
+            values.reserve(node->values.size() + 1);
+            values.insert(values.end(), node->values.begin(), node->values.begin() + i);
+            values.push_back(value);
+            values.insert(values.end(), node->values.begin() + i, node->values.end());
+            return splitIfFull(std::move(values), 0);
+        }
+        // after element i - 1, so that i may equal the node's count
+        size_t k = 0, off = 0;
+        if (i > 0) {
+            std::tie(k, off) = locate(*node, h, i - 1);
+            ++off;
+        }
+        auto [left, right] = insertTree(node->kids[k], h - 1, off, value);
+        std::vector<NodePtr> kids(node->kids);
+        kids[k] = std::move(left);
+        if (right) {
+            kids.insert(kids.begin() + k + 1, std::move(right));
+        }
+        return splitIfFull(std::move(kids), h);
+    }
+
+    template <typename S>
+    static std::pair<NodePtr, NodePtr> splitIfFull(std::vector<S> && slots, size_t h) {
+        if (slots.size() <= WIDTH) {
+            return {build(std::move(slots), h), nullptr};
+        }
+        size_t half = slots.size() / 2;
+        std::vector<S> right(slots.begin() + half, slots.end());
+        slots.resize(half);
+        return {build(std::move(slots), h), build(std::move(right), h)};
+    }
+
+    // Removes element i; null when the node is left empty. A child left
+    // under half full joins a neighbour, so a node ends up with one child
+    // only once its neighbours are gone, and the root's collapses away.
+    static NodePtr removeTree(const NodePtr & node, size_t h, size_t i) {
+        if (h == 0) {
+            if (node->values.size() == 1) {
+                return nullptr;
+            }
+            std::vector<T> values(node->values);
+            values.erase(values.begin() + i);
+            return build(std::move(values), 0);
+        }
+        auto [k, off] = locate(*node, h, i);
+        auto kid = removeTree(node->kids[k], h - 1, off);
+        if (!kid && node->kids.size() == 1) {
+            return nullptr;
+        }
+        std::vector<NodePtr> kids(node->kids);
+        if (!kid) {
+            kids.erase(kids.begin() + k);
+        } else if (slots(*kid, h - 1) < WIDTH / 2 && kids.size() > 1) {
+            kids[k] = std::move(kid);
+            size_t l = k > 0 ? k - 1 : k;
+            auto [left, right] = h == 1
+                ? joinNodes(*kids[l], *kids[l + 1], &Node::values, 0)
+                : joinNodes(*kids[l], *kids[l + 1], &Node::kids, h - 1);
+            kids[l] = std::move(left);
+            if (right) {
+                kids[l + 1] = std::move(right);
+            } else {
+                kids.erase(kids.begin() + l + 1);
+            }
+        } else {
+            kids[k] = std::move(kid);
+        }
+        return build(std::move(kids), h);
+    }
+
+    // Neighbours a and b as one node, or as two even halves when that
+    // would be over WIDTH.
+    template <typename S>
+    static std::pair<NodePtr, NodePtr> joinNodes(const Node & a, const Node & b, std::vector<S> Node::* field,
+                                                 size_t h) {
+        std::vector<S> slots(a.*field);
+        slots.insert(slots.end(), (b.*field).begin(), (b.*field).end());
+        return splitIfFull(std::move(slots), h);
+    }
+
+    static NodePtr assign(const NodePtr & node, size_t h, size_t i, const T & value) {
+        auto copy = Policy::template make<Node>(*node);
+        copy->owner = 0;
+        if (h == 0) {
+            copy->values[i] = value;
+        } else {
+            auto [k, off] = locate(*node, h, i);
+            copy->kids[k] = assign(node->kids[k], h - 1, off, value);
+        }
+        return copy;
+    }
+
+    template <typename Callable>
+    static void forEach(const Node & n, size_t h, const Callable & callback) {
+        if (h == 0) {
+            for (const auto & v : n.values) {
+                callback(v);
+            }
+        } else {
+            for (const auto & k : n.kids) {
+                forEach(*k, h - 1, callback);
+            }
+        }
+    }
+
+    template <typename Callable>
+    static void forEachOwned(const NodePtr & n, size_t h, const Callable & callback) {
+        if (!n || n.use_count() != 1) {
+            return;
+        }
+        if (h == 0) {
+            for (const auto & v : n->values) {
+                callback(v);
+            }
+        } else {
+            for (const auto & k : n->kids) {
+                forEachOwned(k, h - 1, callback);
+            }
+        }
+    }
+
+    static void checkIndex(size_t i, size_t size) {
+        if (i >= size) {
+            throw std::out_of_range("index out of bound");
+        }
+    }
+
+public:
+    RRBVector(NodePtr root, size_t height, size_t size, NodePtr tail)
+        : root_(std::move(root)), height_(height), size_(size), tail_(std::move(tail)) {
+        // a root with one child is just a taller path to the same leaves
+        while (root_ && height_ > 0 && root_->kids.size() == 1) {
+            root_ = root_->kids[0];
+            --height_;
+        }
+    }
+
+    static Pointer create() {
+        return make(nullptr, 0, 0, nullptr);
+    }
+
+    static size_t size(const Pointer & p) {
+        return p->size_;
+    }
+
+    // levels in the tree, not counting the tail
+    static size_t height(const Pointer & p) {
+        return p->root_ ? p->height_ + 1 : 0;
+    }
+
+    static const T & get(const Pointer & p, size_t i) {
+        checkIndex(i, p->size_);
+        size_t tree = p->treeSize();
+        if (i >= tree) {
+            return p->tail_->values[i - tree];
+        }
+        return lookup(p->root_.get(), p->height_, i);
+    }
+
+    static Pointer set(const Pointer & p, size_t i, const T & value) {
+        checkIndex(i, p->size_);
+        size_t tree = p->treeSize();
+        if (i >= tree) {
+            auto tail = build(std::vector<T>(p->tail_->values), 0);
+            tail->values[i - tree] = value;
+            return make(p->root_, p->height_, p->size_, tail);
+        }
+        return make(assign(p->root_, p->height_, i, value), p->height_, p->size_, p->tail_);
+    }
+
+    static Pointer push_back(const Pointer & p, const T & value) {
+        if (p->tailSize() < WIDTH) {
+            std::vector<T> values;
+            values.reserve(p->tailSize() + 1);
+            if (p->tail_) {
+                values = p->tail_->values;
+            }
+            values.push_back(value);
+            return make(p->root_, p->height_, p->size_ + 1, build(std::move(values), 0));
+        }
+        auto [root, h] = concatTrees(p->root_, p->height_, p->tail_, 0);
+        return make(root, h, p->size_ + 1, build(std::vector<T>{value}, 0));
+    }
+
+    static Pointer pop_back(const Pointer & p) {
+        checkIndex(0, p->size_);
+        return take(p, p->size_ - 1);
+    }
+
+    // the first n elements
+    static Pointer take(const Pointer & p, size_t n) {
+        if (n >= p->size_) {
+            return p;
+        }
+        size_t tree = p->treeSize();
+        if (n >= tree) {
+            NodePtr tail;
+            if (n > tree) {
+                tail = build(std::vector<T>(p->tail_->values.begin(), p->tail_->values.begin() + (n - tree)), 0);
+            }
+            return make(p->root_, p->height_, n, tail);
+        }
+        if (n == 0) {
+            return create();
+        }
+        return make(takeTree(p->root_, p->height_, n), p->height_, n, nullptr);
+    }
+
+    // everything after the first n elements
+    static Pointer drop(const Pointer & p, size_t n) {
+        if (n == 0) {
+            return p;
+        }
+        if (n >= p->size_) {
+            return create();
+        }
+        size_t tree = p->treeSize();
+        if (n >= tree) {
+            auto tail = build(std::vector<T>(p->tail_->values.begin() + (n - tree), p->tail_->values.end()), 0);
+            return make(nullptr, 0, p->size_ - n, tail);
+        }
+        return make(dropTree(p->root_, p->height_, n), p->height_, p->size_ - n, p->tail_);
+    }
+
+    static std::pair<Pointer, Pointer> split_at(const Pointer & p, size_t i) {
+        return {take(p, i), drop(p, i)};
+    }
+
+    // elements [from, to)
+    static Pointer slice(const Pointer & p, size_t from, size_t to) {
+        if (from > to || to > p->size_) {
+            throw std::out_of_range("index out of bound");
+        }
+        return take(drop(p, from), to - from);
+    }
+
+    static Pointer concat(const Pointer & a, const Pointer & b) {
+        if (a->size_ == 0) {
+            return b;
+        }
+        if (b->size_ == 0) {
+            return a;
+        }
+        auto [left, hl] = concatTrees(a->root_, a->height_, a->tail_, 0);
+        auto [root, h] = concatTrees(left, hl, b->root_, b->height_);
+        return make(root, h, a->size_ + b->size_, b->tail_);
+    }
+
+    static Pointer insert(const Pointer & p, size_t i, const T & value) {
+        if (i > p->size_) {
+            throw std::out_of_range("index out of bound");
+        }
+        size_t tree = p->treeSize();
+        if (i > tree || (i == tree && !p->root_)) {
+            if (p->tailSize() == WIDTH) {
+                auto [root, h] = concatTrees(p->root_, p->height_, p->tail_, 0);
+                return insert(make(root, h, p->size_, nullptr), i, value);
+            }
+            std::vector<T> values;
+            if (p->tail_) {
+                values = p->tail_->values;
+            }
+            values.insert(values.begin() + (i - tree), value);
+            return make(p->root_, p->height_, p->size_ + 1, build(std::move(values), 0));
+        }
+        auto [left, right] = insertTree(p->root_, p->height_, i, value);
+        if (right) {
+            return make(build(std::vector<NodePtr>{left, right}, p->height_ + 1), p->height_ + 1,
+                        p->size_ + 1, p->tail_);
+        }
+        return make(left, p->height_, p->size_ + 1, p->tail_);
+    }
+
+    static Pointer remove(const Pointer & p, size_t i) {
+        checkIndex(i, p->size_);
+        size_t tree = p->treeSize();
+        if (i >= tree) {
+            NodePtr tail;
+            if (p->tailSize() > 1) {
+                std::vector<T> values(p->tail_->values);
+                values.erase(values.begin() + (i - tree));
+                tail = build(std::move(values), 0);
+            }
+            return make(p->root_, p->height_, p->size_ - 1, tail);
+        }
+        auto root = removeTree(p->root_, p->height_, i);
+        return make(root, root ? p->height_ : 0, p->size_ - 1, p->tail_);
+    }
+
+    template <typename Callable>
+    static void for_each(const Pointer & p, const Callable & callback) {
+        if (p->root_) {
+            forEach(*p->root_, p->height_, callback);
+        }
+        if (p->tail_) {
+            forEach(*p->tail_, 0, callback);
+        }
+    }
+
+    // for_each limited to the elements only this handle reaches; a version
+    // or node shared with another owner is skipped.
+    template <typename Callable>
+    static void for_each_owned(const Pointer & p, const Callable & callback) {
+        if (p.use_count() != 1) {
+            return;
+        }
+        forEachOwned(p->root_, p->height_, callback);
+        forEachOwned(p->tail_, 0, callback);
+    }
+
+    // Single-threaded builder over a version. Leaves and inner nodes it has
+    // copied once are then edited in place.
+    class Transient {
+        NodePtr root_;
+        size_t height_;
+        size_t size_;
+        NodePtr tail_;
+        uint64_t id_;
+
+        static uint64_t nextOwner() {
+            static std::atomic<uint64_t> owner{1};
+            return owner.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        NodePtr & own(NodePtr & n) {
+            if (n->owner != id_) {
+                n = Policy::template make<Node>(*n);
+                n->owner = id_;
+            }
+            return n;
+        }
+
+        size_t tailSize() const {
+            return tail_ ? tail_->values.size() : 0;
+        }
+
+    public:
+        explicit Transient(const Pointer & p = create())
+            : root_(p->root_), height_(p->height_), size_(p->size_), tail_(p->tail_), id_(nextOwner()) {}
+
+        // A copy would edit the same owned nodes in place; fork through
+        // persistent() instead.
+        Transient(const Transient &) = delete;
+        Transient & operator=(const Transient &) = delete;
+        Transient(Transient &&) = default;
+        Transient & operator=(Transient &&) = default;
+
+        size_t size() const {
+            return size_;
+        }
+
+        const T & get(size_t i) const {
+            checkIndex(i, size_);
+            size_t tree = size_ - tailSize();
+            if (i >= tree) {
+                return tail_->values[i - tree];
+            }
+            return lookup(root_.get(), height_, i);
+        }
+
+        void set(size_t i, const T & value) {
+            checkIndex(i, size_);
+            size_t tree = size_ - tailSize();
+            if (i >= tree) {
+                own(tail_)->values[i - tree] = value;
+                return;
+            }
+            Node * n = own(root_).get();
+            for (size_t h = height_; h > 0; --h) {
+                auto [k, off] = locate(*n, h, i);
+                n = own(n->kids[k]).get();
+                i = off;
+            }
+            n->values[i] = value;
+        }
+
+        void push_back(const T & value) {
+            if (tailSize() == WIDTH) {
+                std::tie(root_, height_) = concatTrees(root_, height_, tail_, 0);
+                tail_ = nullptr;
+            }
+            if (!tail_) {
+                tail_ = Policy::template make<Node>();
+                tail_->owner = id_;
+                tail_->values.reserve(WIDTH);
+            }
+            own(tail_)->values.push_back(value);
+            ++size_;
+        }
+
+        // Publishes the current contents. Later edits copy again, so the
+        // returned version never changes.
+        Pointer persistent() {
+            id_ = nextOwner();
+            return make(root_, height_, size_, tail_);
+        }
+    };
+};
@@ -1,242 +1,7 @@
-#include <iostream>
-#include <cassert>
-#include <string>
-#include <memory>
-#include <vector>
-#include <bitset>
-#include <optional>
-#include <sstream>
-
-using BitMap = std::bitset<256>;
-
-static const std::vector<BitMap> mask = []() {
-    std::vector<BitMap> a(256, 0);
-    for (size_t i = 1; i < a.size(); ++i) {
-        a[i] = (a[i - 1] << 1) | BitMap(1);
-    }
-    return a;
-}();
-
-
-template <typename T>
-struct trie {
-    struct Node : public std::enable_shared_from_this<Node> {
-        using NodePtr = std::shared_ptr<const Node>;
-        using DataPtr = std::shared_ptr<const T>;
-        static const BitMap lshift(size_t i) {
-            return ((uint64_t)1) << i;
-        }
-
-        DataPtr data;
-        BitMap bitmap;
-        std::vector< NodePtr > elements;
-
-        Node(DataPtr d, const BitMap & b, std::vector< NodePtr > && e)
-            : data(d), bitmap(b), elements(std::move(e)) {}
-        Node() : bitmap(0) {}
-
-        inline size_t InnerIndex(size_t i) const {
-            return (bitmap & mask[i]).count();
-        }
-
-        NodePtr get(size_t i) const {
-            if (bitmap.test(i)) {
-                return elements[InnerIndex(i)];
-            } else {
-                return nullptr;
-            }
-        }
-
-        size_t size() const {
-            return elements.size();
-        }
-
-        NodePtr setData(const T & d) const {
-            if (data && d == *data) {
-                return this->shared_from_this();
-            } else {
-                std::vector< NodePtr > e(elements);
-                return std::make_shared<Node>(std::make_shared<T>(d), bitmap, std::move(e));
-            }
-        }
-
-        NodePtr setKid(size_t i, NodePtr kid) const {
-            if (bitmap.test(i)) {
-                if (kid != elements[InnerIndex(i)]) {
-                    std::vector< NodePtr > e(elements);
-                    e[InnerIndex(i)] = kid;
-                    return std::make_shared<Node>(data, bitmap, std::move(e));
-                } else {
-                    return this->shared_from_this();
-                }
-            } else {
-                size_t cnt = InnerIndex(i);
-                std::vector< NodePtr > e(elements.size() + 1);
-                std::copy(elements.begin(), elements.begin() + cnt, e.begin());
-                e[cnt] = kid;
-                std::copy(elements.begin() + cnt, elements.end(), e.begin() + cnt + 1);
-                auto b(bitmap);
-                b.set(i);
-                return std::make_shared<Node>(data, b, std::move(e));
-            }
-        }
-
-        NodePtr clearKid(size_t i) const {
-            if (bitmap.test(i)) {
-                size_t index = InnerIndex(i);
-                std::vector< NodePtr > e(elements.size() - 1);
-                std::copy(elements.begin(), elements.begin() + index, e.begin());
-                std::copy(elements.begin() + index + 1, elements.end(), e.begin() + index);
-                auto b(bitmap);
-                b.reset(i);
-                return std::make_shared<const Node>(data, b, std::move(e));
-            } else {
-                return this->shared_from_this();
-            }
-        }
-
-        NodePtr clearData() const {
-            if (data) {
-                std::vector< NodePtr > e(elements);
-                return std::make_shared<const Node>(nullptr, bitmap, std::move(e));
-            } else {
-                return this->shared_from_this();
-            }
-        }
-    };
-
-    using NodePtr = typename Node::NodePtr;
-    using DataPtr = typename Node::DataPtr;
-
-    static NodePtr remove(NodePtr head, const std::string & key) {
-        return remove(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
-    }
-
-    static NodePtr remove(NodePtr head, const uint8_t *key, size_t len) {
-        if (!head) {
-            return head;
-        } else {
-            if (len == 0) {
-                if (head->size()) {
-                    return head->clearData();
-                } else {
-                    return nullptr;
-                }
-            } else {
-                if (head->get(key[0])) {
-                    auto p = remove(head->get(key[0]), key + 1, len - 1);
-                    if (p) {
-                        return head->setKid(key[0], p);
-                    } else {
-                        if (head->size() == 1 && !(head->data)) {
-                            return nullptr;
-                        } else {
-                            return head->clearKid(key[0]);
-                        }
-                    }
-                } else {
-                    return head;
-                }
-            }
-        }
-    }
-
-    static NodePtr insert(NodePtr head, const std::string & key, const T & data) {
-        return insert(head, reinterpret_cast<const uint8_t *>(key.data()), key.size(), data);
-    }
+#include "thread_safe_trie.h"
+#include "read_scaling.h"
 
-    static NodePtr insert(NodePtr head, const uint8_t *key, size_t len, const T & data) {
-        if (!head) {
-            std::vector< NodePtr > branches;
-            auto p = std::make_shared<const Node>(std::make_shared<T>(data), BitMap(), std::move(branches));
-            for (auto i = static_cast<long>(len) - 1; i >= 0; --i) {
-                BitMap b;
-                b.set(key[i]);
-                std::vector< NodePtr > branches = {p,};
-                p = std::make_shared<const Node>(nullptr, b, std::move(branches));
-            }
-            return p;
-        } else {
-            if (len == 0) {
-                return head->setData(data);
-            } else {
-                auto p = insert(head->get(key[0]), key + 1, len - 1, data);
-                return head->setKid(key[0], p);
-            }
-        }
-    }
-
-    static std::optional<T> find(NodePtr head, const std::string & key) {
-        return find(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
-    }
-
-    static std::optional<T> find(NodePtr head, const uint8_t *key, size_t len) {
-        auto p = head;
-        for (size_t i = 0; i < len; ++i) {
-            if (!p) {
-                return std::nullopt;
-            }
-            p = p->get(key[i]);
-        }
-        if (p && p->data) {
-            return *(p->data);
-        } else {
-            return std::nullopt;
-        }
-    }
-
-    static std::vector<T> findPrefix(NodePtr head, const std::string & key) {
-        return findPrefix(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
-    }
-
-    static std::vector<T> findPrefix(NodePtr head, const uint8_t *key, size_t len) {
-        auto p = head;
-        std::vector<T> r;
-        for (size_t i = 0; i < len; ++i) {
-            if (!p) {
-                break;
-            }
-            if (p->data) {
-                r.push_back(*(p->data));
-            }
-            p = p->get(key[i]);
-        }
-        if (p && p->data) {
-            r.push_back(*(p->data));
-        }
-        return r;
-    }
-
-    static void dump(NodePtr head) {
-        std::cout << "digraph G {\n";
-        dump_node(head);
-        std::cout << "}\n";
-    }
-
-    static std::string dump_node(NodePtr head) {
-        if (!head) {
-            return "empty";
-        }
-        std::stringstream ss;
-        ss << "node_" << head.get();
-        if (head->data) {
-            ss << "_value_" << *(head->data);
-        }
-        const auto & head_name = ss.str();
-
-        for (int i = 0; i < 256; ++i) {
-            const auto & kid = head->get(i);
-            if (kid) {
-                const auto & kid_name = dump_node(kid);
-                std::cout << head_name << " -> " << kid_name << " [ label=\"" << (char)i << "\" ];\n";
-            }
-        }
-        if (head->data) {
-            std::cout << head_name << " [style=filled, fillcolor=red];\n";
-        }
-        return head_name;
-    }
-};
+#include <map>
 
 void test_remove() {
     using IntTrie = trie<int>;
@@ -312,7 +77,271 @@ void test_prefix() {
     }
 }
 
-int main() {
+void test_stats() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    {
+        auto s = IntTrie::stats(p);
+        assert(s.nodes == 0);
+        assert(s.bytes == 0);
+    }
+
+    const int limit = 1000;
+    for (int i = 0; i < limit; ++i) {
+        p = IntTrie::insert(p, std::to_string(i), i);
+    }
+    auto s = IntTrie::stats(p);
+    assert(s.leaves == limit);
+    // "0".."9", "10".."99", "100".."999"
+    assert(s.depth.size() == 4);
+    assert(s.depth[1] == 10 && s.depth[2] == 90 && s.depth[3] == 900);
+    size_t nodes = 0, kids = 0;
+    for (size_t k = 0; k < s.fanout.size(); ++k) {
+        nodes += s.fanout[k];
+        kids += k * s.fanout[k];
+    }
+    assert(nodes == s.nodes);
+    assert(kids == s.nodes - 1);
+
+    assert(IntTrie::shared_bytes(p, p) == s.bytes);
+
+    // only the nodes on the path to "1000" are copied; the values they hold
+    // are still shared
+    auto q = IntTrie::insert(p, "1000", 1000);
+    size_t copied = 0;
+    auto n = p;
+    for (char ch : std::string("1000")) {
+        copied += IntTrie::nodeBytes(*n);
+        n = n->get(ch);
+    }
+    assert(IntTrie::shared_bytes(p, q) == s.bytes - copied);
+
+    IntTrie::NodePtr fresh;
+    for (int i = 0; i < limit; ++i) {
+        fresh = IntTrie::insert(fresh, std::to_string(i), i);
+    }
+    assert(IntTrie::shared_bytes(p, fresh) == 0);
+}
+
+void test_string_view() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    std::string_view request = "GET /a/b HTTP/1.1";
+    p = IntTrie::insert(p, request.substr(4, 2), 1);
+    p = IntTrie::insert(p, request.substr(4, 4), 2);
+    p = IntTrie::insert(p, std::string("/c"), 3);
+
+    assert(IntTrie::find(p, "/a") == 1);
+    assert(IntTrie::find(p, request.substr(4, 4)) == 2);
+    assert(IntTrie::contains(p, request.substr(4, 4)));
+    assert(!IntTrie::contains(p, request.substr(4, 3)));
+    assert(vectorEqual(IntTrie::findPrefix(p, request.substr(4, 4)), std::vector<int>{1, 2}));
+
+    p = IntTrie::remove(p, request.substr(4, 2));
+    assert(!IntTrie::contains(p, "/a"));
+    assert(IntTrie::contains(p, "/a/b"));
+}
+
+void test_find_ptr() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    assert(!IntTrie::find_ptr(p, "1"));
+    const int limit = 1000;
+    for (int i = 0; i < limit; ++i) {
+        p = IntTrie::insert(p, std::to_string(i), i);
+    }
+    for (int i = 0; i < limit; ++i) {
+        const int *v = IntTrie::find_ptr(p, std::to_string(i));
+        assert(v && *v == i);
+    }
+    assert(!IntTrie::find_ptr(p, "1000"));
+    assert(!IntTrie::find_ptr(p, ""));
+
+    // the borrowed pointer is tied to the version, not to the latest one
+    const int *v = IntTrie::find_ptr(p, "7");
+    auto q = IntTrie::remove(p, "7");
+    assert(!IntTrie::find_ptr(q, "7"));
+    assert(*v == 7);
+}
+
+void test_for_each() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    IntTrie::for_each(p, [](std::string_view, int) {
+        assert(false);
+    });
+    std::vector<std::string> keys = {"", "a", "ab", "abc", "b", "ba", "\x80", "\xff\x01"};
+    for (size_t i = keys.size(); i-- > 0;) {
+        p = IntTrie::insert(p, keys[i], i);
+    }
+    size_t n = 0;
+    IntTrie::for_each(p, [&](std::string_view key, int v) {
+        assert(key == keys[n] && v == int(n));
+        ++n;
+    });
+    assert(n == keys.size());
+}
+
+void test_for_each_owned() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    const int limit = 1000;
+    for (int i = 0; i < limit; ++i) {
+        p = IntTrie::insert(p, std::to_string(i), i);
+    }
+    std::map<const int *, int> seen;
+    auto visit = [&](const int & v) {
+        ++seen[&v];
+    };
+    IntTrie::for_each_owned(p, visit);
+    assert(seen.size() == limit);
+
+    // "5" and its path are copied; everything else is shared and skipped
+    auto q = IntTrie::insert(p, "5", -5);
+    seen.clear();
+    IntTrie::for_each_owned(p, visit);
+    IntTrie::for_each_owned(q, visit);
+    assert(seen.size() == 2);
+    for (const auto & [v, n] : seen) {
+        assert(n == 1);
+    }
+}
+
+static size_t allocations = 0;
+static size_t arrays = 0;   // allocations of more than one object: the child vectors
+
+template <typename T>
+struct CountingAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = CountingAllocator<U>;
+    };
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &) {}
+
+    T * allocate(size_t n) {
+        ++allocations;
+        arrays += n > 1;
+        return std::allocator<T>::allocate(n);
+    }
+};
+
+void test_policy() {
+    using LocalTrie = trie<int, SingleThreadRefCount<CountingAllocator>>;
+    LocalTrie::NodePtr p;
+    const int limit = 1000;
+    for (int i = 0; i < limit; ++i) {
+        p = LocalTrie::insert(p, std::to_string(i), i);
+    }
+    assert(allocations > limit);
+    assert(arrays > 0);
+    for (int i = 0; i < limit; ++i) {
+        if (i % 2) {
+            p = LocalTrie::remove(p, std::to_string(i));
+        }
+    }
+    for (int i = 0; i < limit; ++i) {
+        assert(LocalTrie::contains(p, std::to_string(i)) == (i % 2 == 0));
+        assert(i % 2 || *LocalTrie::find_ptr(p, std::to_string(i)) == i);
+    }
+    assert(LocalTrie::stats(p).leaves == limit / 2);
+}
+
+// Build with -DPERSIST_COUNTERS=1 or =2 to exercise the counters.
+void test_counters() {
+    using IntTrie = trie<int>;
+    IntTrie::NodePtr p;
+    counters::reset();
+    p = IntTrie::insert(p, "abc", 1);
+    auto s = counters::thread_snapshot();
+    if constexpr (!counters::ENABLED) {
+        assert(s.ops[counters::INSERT] == 0);
+        return;
+    }
+    // a fresh chain: three edges, a tail and the value, nothing copied
+    assert(s.ops[counters::INSERT] == 1);
+    assert(s.events[counters::ALLOC] == 5);
+    assert(s.events[counters::PATH_COPY] == 0);
+
+    counters::reset();
+    p = IntTrie::insert(p, "abd", 2);
+    s = counters::thread_snapshot();
+    // "", "a" and "ab" are copied; "ab" gains a kid, so one pointer is carried over
+    assert(s.ops[counters::INSERT] == 1);
+    assert(s.events[counters::PATH_COPY] == 3);
+    assert(s.events[counters::PTR_COPY] == 1);
+    assert(s.events[counters::LEVEL] == 3);
+
+    counters::reset();
+    p = IntTrie::remove(p, "abc");
+    s = counters::thread_snapshot();
+    assert(s.ops[counters::REMOVE] == 1);
+    assert(s.events[counters::LEVEL] == 3);
+    assert(s.events[counters::PATH_COPY] == 3);
+    if constexpr (counters::HISTOGRAMS) {
+        assert(s.histogram[counters::REMOVE][counters::PATH_COPY][counters::bucket(3)] == 1);
+    }
+}
+
+// The baseline walks with get(), copying a NodePtr per level the way find
+// did before find_ptr existed.
+void bench_read_scaling() {
+    using IntTrie = trie<int>;
+    std::vector<std::string> keys;
+    IntTrie::NodePtr p;
+    for (int i = 0; i < (1 << 16); ++i) {
+        keys.push_back("user:" + std::to_string(i * 7919));
+        p = IntTrie::insert(p, keys.back(), i);
+    }
+    auto counted = [&](const std::string & key) {
+        IntTrie::NodePtr n = p;
+        for (size_t i = 0; n && i < key.size(); ++i) {
+            n = n->get(static_cast<uint8_t>(key[i]));
+        }
+        return n && n->data;
+    };
+    read_scaling(keys, counted,
+                 [&](const std::string & key) { return IntTrie::find_ptr(p, key) != nullptr; });
+}
+
+template <typename Trie>
+static double bench_insert() {
+    const int limit = 1 << 17;
+    std::vector<std::string> keys;
+    for (int i = 0; i < limit; ++i) {
+        keys.push_back("user:" + std::to_string(i * 7919));
+    }
+    auto start = std::chrono::steady_clock::now();
+    typename Trie::NodePtr p;
+    for (int i = 0; i < limit; ++i) {
+        p = Trie::insert(p, keys[i], i);
+    }
+    for (int i = 0; i < limit; i += 2) {
+        p = Trie::remove(p, keys[i]);
+    }
+    return limit * 1.5 / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+void bench_policy() {
+    std::cout << "insert+remove Mops/s: atomic " << bench_insert<trie<int>>()
+              << ", single-thread " << bench_insert<trie<int, SingleThreadRefCount<>>>() << "\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        bench_read_scaling();
+        bench_policy();
+        return 0;
+    }
     test_prefix();
     test_remove();
+    test_stats();
+    test_string_view();
+    test_find_ptr();
+    test_for_each();
+    test_for_each_owned();
+    test_policy();
+    test_counters();
 }
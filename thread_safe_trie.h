@@ -0,0 +1,433 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <bitset>
+#include <optional>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+#include "ownership.h"
+#include "counters.h"
+
+using BitMap = std::bitset<256>;
+
+static const std::vector<BitMap> mask = []() {
+    std::vector<BitMap> a(256, 0);
+    for (size_t i = 1; i < a.size(); ++i) {
+        a[i] = (a[i - 1] << 1) | BitMap(1);
+    }
+    return a;
+}();
+
+
+template <typename T, typename Policy = AtomicRefCount<>>
+struct trie {
+    struct Node : public Policy::template EnableShared<Node> {
+        using NodePtr = typename Policy::template Ptr<const Node>;
+        using DataPtr = typename Policy::template Ptr<const T>;
+        using Elements = std::vector<NodePtr, typename Policy::template Allocator<NodePtr>>;
+        static const BitMap lshift(size_t i) {
+            return ((uint64_t)1) << i;
+        }
+
+        DataPtr data;
+        BitMap bitmap;
+        Elements elements;
+
+        Node(DataPtr d, const BitMap & b, Elements && e)
+            : data(d), bitmap(b), elements(std::move(e)) {}
+        Node() : bitmap(0) {}
+
+        inline size_t InnerIndex(size_t i) const {
+            return (bitmap & mask[i]).count();
+        }
+
+        // borrowed; no reference count is touched
+        const Node * kid(size_t i) const {
+            return bitmap.test(i) ? elements[InnerIndex(i)].get() : nullptr;
+        }
+
+        NodePtr get(size_t i) const {
+            if (bitmap.test(i)) {
+                return elements[InnerIndex(i)];
+            } else {
+                return nullptr;
+            }
+        }
+
+        size_t size() const {
+            return elements.size();
+        }
+
+        NodePtr setData(const T & d) const {
+            if (data && d == *data) {
+                return this->shared_from_this();
+            } else {
+                counters::path_copy(elements.size());
+                counters::count(counters::ALLOC);
+                Elements e(elements);
+                return Policy::template make<Node>(Policy::template make<T>(d), bitmap, std::move(e));
+            }
+        }
+
+        NodePtr setKid(size_t i, NodePtr kid) const {
+            if (bitmap.test(i)) {
+                if (kid != elements[InnerIndex(i)]) {
+                    counters::path_copy(elements.size() - 1);
+                    Elements e(elements);
+                    e[InnerIndex(i)] = kid;
+                    return Policy::template make<Node>(data, bitmap, std::move(e));
+                } else {
+                    return this->shared_from_this();
+                }
+            } else {
+                counters::path_copy(elements.size());
+                size_t cnt = InnerIndex(i);
+                Elements e(elements.size() + 1);
+                std::copy(elements.begin(), elements.begin() + cnt, e.begin());
+                e[cnt] = kid;
+                std::copy(elements.begin() + cnt, elements.end(), e.begin() + cnt + 1);
+                auto b(bitmap);
+                b.set(i);
+                return Policy::template make<Node>(data, b, std::move(e));
+            }
+        }
+
+        NodePtr clearKid(size_t i) const {
+            if (bitmap.test(i)) {
+                counters::path_copy(elements.size() - 1);
+                size_t index = InnerIndex(i);
+                Elements e(elements.size() - 1);
+                std::copy(elements.begin(), elements.begin() + index, e.begin());
+                std::copy(elements.begin() + index + 1, elements.end(), e.begin() + index);
+                auto b(bitmap);
+                b.reset(i);
+                return Policy::template make<const Node>(data, b, std::move(e));
+            } else {
+                return this->shared_from_this();
+            }
+        }
+
+        NodePtr clearData() const {
+            if (data) {
+                counters::path_copy(elements.size());
+                Elements e(elements);
+                return Policy::template make<const Node>(nullptr, bitmap, std::move(e));
+            } else {
+                return this->shared_from_this();
+            }
+        }
+    };
+
+    using NodePtr = typename Node::NodePtr;
+    using DataPtr = typename Node::DataPtr;
+    using Elements = typename Node::Elements;
+
+    static NodePtr remove(NodePtr head, std::string_view key) {
+        return remove(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+    }
+
+    static NodePtr remove(NodePtr head, const uint8_t *key, size_t len) {
+        counters::Scope scope(counters::REMOVE);
+        if (!head) {
+            return head;
+        } else {
+            if (len == 0) {
+                if (head->size()) {
+                    return head->clearData();
+                } else {
+                    return nullptr;
+                }
+            } else {
+                if (head->get(key[0])) {
+                    counters::descend();
+                    auto p = remove(head->get(key[0]), key + 1, len - 1);
+                    if (p) {
+                        return head->setKid(key[0], p);
+                    } else {
+                        if (head->size() == 1 && !(head->data)) {
+                            return nullptr;
+                        } else {
+                            return head->clearKid(key[0]);
+                        }
+                    }
+                } else {
+                    return head;
+                }
+            }
+        }
+    }
+
+    static NodePtr insert(NodePtr head, std::string_view key, const T & data) {
+        return insert(head, reinterpret_cast<const uint8_t *>(key.data()), key.size(), data);
+    }
+
+    static NodePtr insert(NodePtr head, const uint8_t *key, size_t len, const T & data) {
+        counters::Scope scope(counters::INSERT);
+        if (!head) {
+            counters::count(counters::ALLOC, len + 2);   // the chain, its tail and the value
+            Elements branches;
+            auto p = Policy::template make<const Node>(Policy::template make<T>(data), BitMap(), std::move(branches));
+            for (auto i = static_cast<long>(len) - 1; i >= 0; --i) {
+                BitMap b;
+                b.set(key[i]);
+                Elements branches = {p,};
+                p = Policy::template make<const Node>(nullptr, b, std::move(branches));
+            }
+            return p;
+        } else {
+            if (len == 0) {
+                return head->setData(data);
+            } else {
+                counters::descend();
+                auto p = insert(head->get(key[0]), key + 1, len - 1, data);
+                return head->setKid(key[0], p);
+            }
+        }
+    }
+
+    // Borrowed lookup, valid while `head` is held; see ownership.h.
+    static const T * find_ptr(const NodePtr & head, std::string_view key) {
+        return find_ptr(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+    }
+
+    static const T * find_ptr(const NodePtr & head, const uint8_t *key, size_t len) {
+        const Node *p = walk(head.get(), key, len);
+        return p ? p->data.get() : nullptr;
+    }
+
+    static std::optional<T> find(const NodePtr & head, std::string_view key) {
+        return find(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+    }
+
+    static std::optional<T> find(const NodePtr & head, const uint8_t *key, size_t len) {
+        const T *p = find_ptr(head, key, len);
+        if (p) {
+            return *p;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    static bool contains(const NodePtr & head, std::string_view key) {
+        return contains(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+    }
+
+    static bool contains(const NodePtr & head, const uint8_t *key, size_t len) {
+        return find_ptr(head, key, len) != nullptr;
+    }
+
+    static std::vector<T> findPrefix(const NodePtr & head, std::string_view key) {
+        return findPrefix(head, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+    }
+
+    static std::vector<T> findPrefix(const NodePtr & head, const uint8_t *key, size_t len) {
+        const Node *p = head.get();
+        std::vector<T> r;
+        for (size_t i = 0; i < len; ++i) {
+            if (!p) {
+                break;
+            }
+            if (p->data) {
+                r.push_back(*(p->data));
+            }
+            p = p->kid(key[i]);
+        }
+        if (p && p->data) {
+            r.push_back(*(p->data));
+        }
+        return r;
+    }
+
+    static const Node * walk(const Node *p, const uint8_t *key, size_t len) {
+        for (size_t i = 0; i < len && p; ++i) {
+            p = p->kid(key[i]);
+        }
+        return p;
+    }
+
+    // Calls callback(key, value) for every value, in byte order of the keys.
+    template <typename Callable>
+    static void for_each(const NodePtr & head, const Callable & callback) {
+        std::string key;
+        forEach(head.get(), key, callback);
+    }
+
+    // Calls callback(value) for the values only `head` reaches; a node or
+    // value shared with another version or holder is skipped.
+    template <typename Callable>
+    static void for_each_owned(const NodePtr & head, const Callable & callback) {
+        if (!head || head.use_count() != 1) {
+            return;
+        }
+        if (head->data && head->data.use_count() == 1) {
+            callback(*(head->data));
+        }
+        for (const auto & kid : head->elements) {
+            for_each_owned(kid, callback);
+        }
+    }
+
+    /*
+     * Memory and shape statistics. bytes counts every node (including unused
+     * vector capacity) and every value, each with its shared_ptr control
+     * block; memory owned by a T itself is included only when a dataBytes
+     * callable is given.
+     */
+    struct Stats {
+        size_t nodes = 0;
+        size_t leaves = 0;            // nodes holding a value
+        size_t bytes = 0;
+        std::vector<size_t> depth;    // depth[d]: values stored d bytes below the root
+        std::vector<size_t> fanout;   // fanout[k]: nodes with k kids
+    };
+
+    static size_t nodeBytes(const Node & node) {
+        return CONTROL_BLOCK_BYTES + sizeof(Node) + node.elements.capacity() * sizeof(NodePtr);
+    }
+
+    template <typename Callable>
+    static size_t dataBytes(const T & data, const Callable & extraBytes) {
+        return CONTROL_BLOCK_BYTES + sizeof(T) + extraBytes(data);
+    }
+
+    template <typename Callable>
+    static void stats(const NodePtr & head, size_t depth, Stats & s, const Callable & extraBytes) {
+        ++s.nodes;
+        s.bytes += nodeBytes(*head);
+        ++s.fanout[head->size()];
+        if (head->data) {
+            ++s.leaves;
+            s.bytes += dataBytes(*(head->data), extraBytes);
+            if (s.depth.size() <= depth) {
+                s.depth.resize(depth + 1);
+            }
+            ++s.depth[depth];
+        }
+        for (const auto & kid : head->elements) {
+            stats(kid, depth + 1, s, extraBytes);
+        }
+    }
+
+    template <typename Callable>
+    static Stats stats(NodePtr head, const Callable & extraBytes) {
+        Stats s;
+        s.fanout.resize(257);
+        if (head) {
+            stats(head, 0, s, extraBytes);
+        }
+        return s;
+    }
+
+    static Stats stats(NodePtr head) {
+        return stats(head, [](const T &) { return size_t(0); });
+    }
+
+    // values are shared between node copies, so they are tracked separately
+    template <typename Callable>
+    static size_t subtreeBytes(const NodePtr & head, std::unordered_map<const void *, size_t> & seen,
+                               const Callable & extraBytes) {
+        size_t bytes = nodeBytes(*head);
+        if (head->data) {
+            size_t d = dataBytes(*(head->data), extraBytes);
+            seen.emplace(head->data.get(), d);
+            bytes += d;
+        }
+        for (const auto & kid : head->elements) {
+            bytes += subtreeBytes(kid, seen, extraBytes);
+        }
+        seen.emplace(head.get(), bytes);
+        return bytes;
+    }
+
+    static size_t sharedBytes(const NodePtr & head, const std::unordered_map<const void *, size_t> & seen) {
+        auto it = seen.find(head.get());
+        if (it != seen.end()) {
+            return it->second;
+        }
+        size_t bytes = 0;
+        if (head->data) {
+            it = seen.find(head->data.get());
+            if (it != seen.end()) {
+                bytes += it->second;
+            }
+        }
+        for (const auto & kid : head->elements) {
+            bytes += sharedBytes(kid, seen);
+        }
+        return bytes;
+    }
+
+    // Bytes of nodes and values reachable from both versions.
+    template <typename Callable>
+    static size_t shared_bytes(NodePtr a, NodePtr b, const Callable & extraBytes) {
+        if (!a || !b) {
+            return 0;
+        }
+        std::unordered_map<const void *, size_t> seen;
+        subtreeBytes(a, seen, extraBytes);
+        return sharedBytes(b, seen);
+    }
+
+    static size_t shared_bytes(NodePtr a, NodePtr b) {
+        return shared_bytes(a, b, [](const T &) { return size_t(0); });
+    }
+
+    static void dump(NodePtr head) {
+        std::cout << "digraph G {\n";
+        dump_node(head);
+        std::cout << "}\n";
+    }
+
+    static std::string dump_node(NodePtr head) {
+        if (!head) {
+            return "empty";
+        }
+        std::stringstream ss;
+        ss << "node_" << head.get();
+        if (head->data) {
+            ss << "_value_" << *(head->data);
+        }
+        const auto & head_name = ss.str();
+
+        for (int i = 0; i < 256; ++i) {
+            const auto & kid = head->get(i);
+            if (kid) {
+                const auto & kid_name = dump_node(kid);
+                std::cout << head_name << " -> " << kid_name << " [ label=\"" << (char)i << "\" ];\n";
+            }
+        }
+        if (head->data) {
+            std::cout << head_name << " [style=filled, fillcolor=red];\n";
+        }
+        return head_name;
+    }
+
+private:
+    template <typename Callable>
+    static void forEach(const Node *p, std::string & key, const Callable & callback) {
+        if (!p) {
+            return;
+        }
+        if (p->data) {
+            callback(std::string_view(key), *(p->data));
+        }
+        size_t k = 0;
+        for (size_t i = 0; i < p->bitmap.size() && k < p->elements.size(); ++i) {
+            if (p->bitmap.test(i)) {
+                key.push_back(static_cast<char>(i));
+                forEach(p->elements[k++].get(), key, callback);
+                key.pop_back();
+            }
+        }
+    }
+};